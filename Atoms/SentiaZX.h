@@ -5,87 +5,1872 @@
 #include <graphics.h>
 #include <games.h>
 #include <stdio.h>
+#include <string.h>
+
+
+// Start address of every pixel line in the display file.
+// The Spectrum screen is stored in thirds with the lines interleaved, this saves working it out each time.
+uchar* m_ScreenRows[192];
+
+// Start address of every row of attributes.
+uchar* m_AttribRows[24];
+
+// Fill in the screen address tables, needs calling once before anything uses them.
+void SetupScreenTables()
+{
+	uchar y;
+
+	for(y = 0; y < 192; y++)
+	{
+		m_ScreenRows[y] = (uchar*)(0x4000 | ((y & 0xC0) << 5) | ((y & 0x07) << 8) | ((y & 0x38) << 2));
+	}
+
+	for(y = 0; y < 24; y++)
+	{
+		m_AttribRows[y] = (uchar*)(0x5800 + (y << 5));
+	}
+}
+
+
+uchar m_BitMask[] = { 1, 2, 4, 8, 16, 32, 64, 128 };
+
+
+#ifdef DOUBLE_BUFFER
+// 128K double buffering, build with -DDOUBLE_BUFFER to use it.
+// Everything still draws to the normal screen at $4000 (bank 5), but while that's going on the
+// shadow screen (bank 7) is what's shown. Halt() flips to the normal screen, copies the characters that
+// changed across to the shadow screen and flips back, so a half drawn frame is never on show.
+// Drawing code has to mark what it changes with ShadowMark / ShadowMarkArea / ShadowMarkAll.
+// Bank 7 is paged in at $C000 for the copies, with interrupts left on. The program, the frame interrupt and
+// its vector table are all below $C000 (see SetupFrameInterrupt), so they carry on as normal, and
+// ShadowStackFits checks the stack is too, if it isn't double buffering is left off.
+// On a 48K there's no paging, m_DoubleBuffer stays 0 and everything draws straight to the screen as normal.
+
+// Values for port $7FFD, all keep the 48K ROM and bank 0 paged in.
+#define BANK_SHOW_MAIN 0x10
+#define BANK_SHOW_SHADOW 0x18
+
+uchar m_DoubleBuffer = 0;
+
+// Characters that have changed on the normal screen since the shadow screen was last brought up to date.
+uchar m_ShadowDirty[96];
+uchar m_ShadowAll = 0;
+
+// Work out if there's 128K paging by paging bank 1 in and writing to $C000.
+// If $C000 in bank 0 changed there was no paging, either way it gets put back.
+uchar Has128KPaging()
+{
+#asm
+	di
+	ld hl, $C000
+	ld d, (hl)		; d = what is there now, e = something different
+	ld a, d
+	cpl
+	ld e, a
+
+	ld bc, $7FFD
+	ld a, $11		; bank 1 at $C000
+	out (c), a
+	ld (hl), e
+	ld a, $10		; back to bank 0
+	out (c), a
+
+	ld a, (hl)
+	ld (hl), d
+	cp d
+	ld hl, 0
+	jr nz, has128k_no
+	inc l
+.has128k_no
+	ei
+#endasm
+}
+
+void __FASTCALL__ SetBankPort(uchar port)
+{
+#asm
+	ld a, l
+	ld bc, $7FFD
+	out (c), a
+#endasm
+}
+
+// Copy one character (pixels and attribute) from the normal screen to the shadow screen.
+// screen is the address of the character's top line.
+void __FASTCALL__ ShadowCopyChar(uchar* screen)
+{
+#asm
+	ld bc, $7FFD
+	ld a, $17		; bank 7 at $C000, normal screen shown
+	out (c), a
+
+	ld d, h			; de = the same place in the shadow screen
+	set 7, d
+	ld e, l
+	push hl
+
+	ld a, (hl)
+	ld (de), a
+	inc h
+	inc d
+	ld a, (hl)
+	ld (de), a
+	inc h
+	inc d
+	ld a, (hl)
+	ld (de), a
+	inc h
+	inc d
+	ld a, (hl)
+	ld (de), a
+	inc h
+	inc d
+	ld a, (hl)
+	ld (de), a
+	inc h
+	inc d
+	ld a, (hl)
+	ld (de), a
+	inc h
+	inc d
+	ld a, (hl)
+	ld (de), a
+	inc h
+	inc d
+	ld a, (hl)
+	ld (de), a
+
+	; the attribute, the third of the screen is in bits 3 and 4 of the high byte of the top line.
+	pop hl
+	ld a, h
+	rrca
+	rrca
+	rrca
+	and 3
+	or $58
+	ld h, a
+	ld d, a
+	set 7, d
+	ld e, l
+	ld a, (hl)
+	ld (de), a
+
+	ld a, $10		; bank 0 back in
+	out (c), a
+#endasm
+}
+
+// Copy the whole of the normal screen to the shadow screen.
+void ShadowCopyAll()
+{
+#asm
+	ld bc, $7FFD
+	ld a, $17		; bank 7 at $C000, normal screen shown
+	out (c), a
+
+	ld hl, $4000
+	ld de, $C000
+	ld bc, 6912
+	ldir
+
+	ld bc, $7FFD
+	ld a, $10		; bank 0 back in
+	out (c), a
+#endasm
+}
+
+void MarkShadow(uchar col, uchar row)
+{
+	unsigned int t;
+
+	if(m_DoubleBuffer)
+	{
+		t = ((unsigned int)row << 5) + col;
+		m_ShadowDirty[t >> 3] |= m_BitMask[t & 7];
+	}
+}
+
+void ShadowMarkArea(uchar x1, uchar x2, uchar y1, uchar y2)
+{
+	uchar x, y;
+
+	if(m_DoubleBuffer)
+	{
+		for(y = y1; y <= y2; y++)
+		{
+			for(x = x1; x <= x2; x++)
+			{
+				MarkShadow(x, y);
+			}
+		}
+	}
+}
+
+// Everything that runs with bank 7 paged in has to be below $C000 or it pages itself out. SetupFrameInterrupt
+// has already made sure the program ends below $BDBD, so that leaves the stack, which the copies and the
+// frame interrupt both use. Returns 1 if it's below $C000.
+uchar ShadowStackFits()
+{
+#asm
+	ld hl, 0
+	add hl, sp
+	ld a, h
+	ld hl, 0
+	cp $C0
+	ret nc			; the stack is up there
+	inc l
+#endasm
+}
+
+// Show the normal screen, bring the shadow screen up to date with it and then show that instead.
+// Called by Halt() so it happens just after the interrupt.
+void PresentScreen()
+{
+	uchar b, bit;
+	unsigned int t;
+
+	if(!m_DoubleBuffer)
+	{
+		return;
+	}
+
+	SetBankPort(BANK_SHOW_MAIN);
+
+	if(m_ShadowAll)
+	{
+		ShadowCopyAll();
+		memset(m_ShadowDirty, 0, 96);
+		m_ShadowAll = 0;
+	}
+	else
+	{
+		for(b = 0; b < 96; b++)
+		{
+			if(!m_ShadowDirty[b])
+			{
+				continue;
+			}
+
+			t = (unsigned int)b << 3;
+			for(bit = 0; bit < 8; bit++, t++)
+			{
+				if(m_ShadowDirty[b] & m_BitMask[bit])
+				{
+					ShadowCopyChar(m_ScreenRows[(t >> 5) << 3] + (t & 31));
+				}
+			}
+
+			m_ShadowDirty[b] = 0;
+		}
+	}
+
+	SetBankPort(BANK_SHOW_SHADOW);
+}
+
+#define ShadowMark(col, row) MarkShadow(col, row)
+#define ShadowMarkAll() m_ShadowAll = 1
+
+#else
+
+#define ShadowMark(col, row)
+#define ShadowMarkArea(x1, x2, y1, y2)
+#define ShadowMarkAll()
+
+#endif
 
 
 // Set the Attribute at the row col (in attribute space)
 void SetAttrib(uchar row, uchar col, uchar attrib)
 {
-	uchar* att = 0;
-	att = zx_cyx2aaddr(row,col);
-
-	if(att != 0)
+	if(row < 24 && col < 32)
 	{
-		(*att) = attrib;
+		m_AttribRows[row][col] = attrib;
+		ShadowMark(col, row);
 	}
 }
 
+// Fill len bytes (1 to 255) from dst onwards with value.
+// ASM because this sits under every area fill, it's just a tight store loop.
+void FillBytes(uchar* dst, uchar len, uchar value)
+{
+#asm
+	ld hl, 2
+	add hl, sp
+	ld a, (hl)		; a = value
+	inc hl
+	inc hl
+	ld b, (hl)		; b = len
+	inc hl
+	inc hl
+	ld e, (hl)		; hl = dst
+	inc hl
+	ld h, (hl)
+	ld l, e
+
+	inc b
+	dec b
+	ret z
+
+.fillbytes_loop
+	ld (hl), a
+	inc hl
+	djnz fillbytes_loop
+#endasm
+}
+
 // Set the attributes of a whole area, to the same attribute.
+// Works a row at a time because that's the way the attributes are laid out in memory.
+// Anything past the edge of the screen is clipped off.
 void SetAttribArea(uchar x1, uchar x2, uchar y1, uchar y2, uchar attrib)
 {
-	uchar x, y;
-	//uchar* att = 0;
+	uchar y;
+
+	if(x2 > 31)
+	{
+		x2 = 31;
+	}
+
+	if(y2 > 23)
+	{
+		y2 = 23;
+	}
+
+	if(x1 > x2)
+	{
+		return;
+	}
+
+	for(y = y1; y <= y2; y++)
+	{
+		FillBytes(m_AttribRows[y] + x1, (x2 - x1) + 1, attrib);
+	}
+
+	ShadowMarkArea(x1, x2, y1, y2);
+}
+
+// Fill the whole screen, every pixel byte set to pixels and every attribute to attrib.
+// This moves the stack pointer to the end of the screen and PUSHes its way back down,
+// 2 bytes for 11 T-states, so the whole lot is done in about half a frame.
+// Interrupts are off while SP is pointing at the screen (an interrupt would push its return address
+// onto it), and only turned back on if they were on to start with.
+void FillScreen(uchar pixels, uchar attrib)
+{
+#asm
+	ld hl, 2
+	add hl, sp
+	ld e, (hl)		; e = attrib
+	inc hl
+	inc hl
+	ld d, (hl)		; d = pixels
+
+	ld a, i			; P/V = interrupts enabled
+	push af
+	di
+	ld (fillscreen_restore + 1), sp
+
+	ld sp, $5B00		; the end of the attributes
+	ld h, e
+	ld l, e
+	ld b, 24		; 24 x 32 bytes of attributes
+.fillscreen_attribs
+	push hl
+	push hl
+	push hl
+	push hl
+	push hl
+	push hl
+	push hl
+	push hl
+	push hl
+	push hl
+	push hl
+	push hl
+	push hl
+	push hl
+	push hl
+	push hl
+	djnz fillscreen_attribs
+
+	ld h, d			; then carry on down through the pixels
+	ld l, d
+	ld b, 192		; 192 x 32 bytes of pixels
+.fillscreen_pixels
+	push hl
+	push hl
+	push hl
+	push hl
+	push hl
+	push hl
+	push hl
+	push hl
+	push hl
+	push hl
+	push hl
+	push hl
+	push hl
+	push hl
+	push hl
+	push hl
+	djnz fillscreen_pixels
 
-	for(x = x1 ; x <= x2 ; x++)
+.fillscreen_restore
+	ld sp, 0		; the real SP gets written in here
+	pop af
+	jp po, fillscreen_done
+	ei
+.fillscreen_done
+#endasm
+	ShadowMarkAll();
+}
+
+// Clear all the pixels and set the attributes, what clg() and a full screen SetAttribArea did.
+#define ClearScreen(attrib) FillScreen(0, attrib)
+
+// Paint an attribute mask (see sprites.h) with its top left at x, y, into attribs
+// (laid out like the screen's attributes, 32 a row).
+// The mask is a run length list in screen order so this is one pass down the attributes,
+// with palette giving the colour for each number used in the mask.
+void ApplyAttribMaskTo(uchar* attribs, uchar* mask, uchar x, uchar y, uchar* palette)
+{
+	uchar* att = attribs + ((unsigned int)y << 5) + x;
+	uchar* run = mask + 2;
+	uchar count;
+
+	while((count = run[0]) != 0)
 	{
-		for(y =y1;y <= y2;y++)
+		if (run[1])
 		{
-			*zx_cyx2aaddr(y,x) = attrib;
+			FillBytes(att, count, palette[run[1]]);
 		}
+		att += count;
+		run += 2;
 	}
 }
 
-void DrawString(uchar x, uchar y, char* line, uchar * font)
+// Paint an attribute mask straight on the screen.
+void ApplyAttribMask(uchar* mask, uchar x, uchar y, uchar* palette)
+{
+	ApplyAttribMaskTo((uchar*)(0x5800), mask, x, y, palette);
+	ShadowMarkArea(x, x + mask[0] - 1, y, y + mask[1] - 1);
+}
+
+// Fill an area of the screen pixels, in character columns (x1 to x2) and pixel lines (y1 to y2).
+// Handy as a quicker clga for anything that sits on character boundaries.
+void FillScreenArea(uchar x1, uchar x2, uchar y1, uchar y2, uchar value)
+{
+	uchar y;
+
+	if(x2 > 31)
+	{
+		x2 = 31;
+	}
+
+	if(y2 > 191)
+	{
+		y2 = 191;
+	}
+
+	if(x1 > x2)
+	{
+		return;
+	}
+
+	for(y = y1; y <= y2; y++)
+	{
+		FillBytes(m_ScreenRows[y] + x1, (x2 - x1) + 1, value);
+	}
+
+	ShadowMarkArea(x1, x2, y1 >> 3, y2 >> 3);
+}
+
+// Add one to a 4 digit packed BCD number, low byte first.
+void __FASTCALL__ BcdIncrement(uchar* bcd)
+{
+#asm
+	ld a, (hl)
+	add a, 1
+	daa
+	ld (hl), a
+	inc hl
+	ld a, (hl)
+	adc a, 0
+	daa
+	ld (hl), a
+#endasm
+}
+
+// Turn a byte (0 to 99) into 2 packed BCD digits.
+uchar BcdFromByte(uchar value)
+{
+	uchar tens = 0;
+
+	while(value >= 10)
+	{
+		value -= 10;
+		tens += 16;
+	}
+
+	return tens | value;
+}
+
+// Fonts are a first character code and how many glyphs there are, followed by a 10 byte sprite
+// (width, height, 8 lines) per glyph. Anything outside them is drawn as a blank.
+#define FONT_FIRST 0
+#define FONT_GLYPHS 1
+#define FONT_HEADER 2
+
+// Pre-shifted copy of a font for one pixel offset, 16 bytes per glyph.
+// Each line is stored as a pair, the bits that land in the left byte then the bits that spill into the right one.
+// Only one font and shift are kept. Define FONT_CACHE_GLYPHS before including this to size it for the
+// fonts that get drawn off a character boundary, glyphs past that are drawn as blanks when shifted.
+#ifndef FONT_CACHE_GLYPHS
+#define FONT_CACHE_GLYPHS 96
+#endif
+
+uchar m_FontCache[FONT_CACHE_GLYPHS * 16];
+uchar* m_FontCacheFont = 0;
+uchar m_FontCacheShift = 0;
+uchar m_FontCacheGlyphs = 0;
+
+uchar m_BlankGlyph[16];
+
+void BuildFontCache(uchar* font, uchar shift)
+{
+	uchar letter;
+	uchar l;
+	uchar* glyph;
+	uchar* cache = m_FontCache;
+	uchar glyphs = font[FONT_GLYPHS];
+
+	if (glyphs > FONT_CACHE_GLYPHS)
+	{
+		glyphs = FONT_CACHE_GLYPHS;
+	}
+
+	for(letter = 0; letter < glyphs; letter++)
+	{
+		glyph = font + FONT_HEADER + (letter * 10) + 2;
+
+		for(l = 0; l < 8; l++)
+		{
+			*cache++ = glyph[l] >> shift;
+			*cache++ = glyph[l] << (8 - shift);
+		}
+	}
+
+	m_FontCacheFont = font;
+	m_FontCacheShift = shift;
+	m_FontCacheGlyphs = glyphs;
+}
+
+// Draw one pre-shifted glyph at screen (top line of the character its left half goes in).
+// The left half is OR'd in, since the glyph before has already put its right half there,
+// the right half is stored straight, which clears whatever was under it.
+void ShiftedGlyph(uchar* screen, uchar* cached)
+{
+#asm
+	ld hl, 2
+	add hl, sp
+	ld e, (hl)		; de = cached
+	inc hl
+	ld d, (hl)
+	inc hl
+	ld a, (hl)		; hl = screen
+	inc hl
+	ld h, (hl)
+	ld l, a
+	ex de, hl		; hl = cached, de = screen
+
+	ld b, 8
+.shiftedglyph_loop
+	ld a, (de)
+	or (hl)
+	ld (de), a
+	inc hl
+	inc e
+	ld a, (hl)
+	ld (de), a
+	inc hl
+	dec e
+	inc d			; down a pixel line
+	djnz shiftedglyph_loop
+#endasm
+}
+
+// Copy 8 bytes from src into the character on screen at screen (the address of its top line).
+void PutChar8(uchar* screen, uchar* src)
+{
+#asm
+	ld hl, 2
+	add hl, sp
+	ld e, (hl)		; de = src
+	inc hl
+	ld d, (hl)
+	inc hl
+	ld a, (hl)		; hl = screen
+	inc hl
+	ld h, (hl)
+	ld l, a
+	ex de, hl		; hl = src, de = screen
+
+	; inc d moves down a pixel line inside a character
+	ld a, (hl)
+	ld (de), a
+	inc hl
+	inc d
+	ld a, (hl)
+	ld (de), a
+	inc hl
+	inc d
+	ld a, (hl)
+	ld (de), a
+	inc hl
+	inc d
+	ld a, (hl)
+	ld (de), a
+	inc hl
+	inc d
+	ld a, (hl)
+	ld (de), a
+	inc hl
+	inc d
+	ld a, (hl)
+	ld (de), a
+	inc hl
+	inc d
+	ld a, (hl)
+	ld (de), a
+	inc hl
+	inc d
+	ld a, (hl)
+	ld (de), a
+#endasm
+}
+
+// Copy the 8 bytes of the character on screen at screen into dst, the opposite of PutChar8.
+void GetChar8(uchar* dst, uchar* screen)
+{
+#asm
+	ld hl, 2
+	add hl, sp
+	ld e, (hl)		; de = screen
+	inc hl
+	ld d, (hl)
+	inc hl
+	ld a, (hl)		; hl = dst
+	inc hl
+	ld h, (hl)
+	ld l, a
+	ex de, hl		; hl = screen, de = dst
+
+	ld a, (hl)
+	ld (de), a
+	inc de
+	inc h
+	ld a, (hl)
+	ld (de), a
+	inc de
+	inc h
+	ld a, (hl)
+	ld (de), a
+	inc de
+	inc h
+	ld a, (hl)
+	ld (de), a
+	inc de
+	inc h
+	ld a, (hl)
+	ld (de), a
+	inc de
+	inc h
+	ld a, (hl)
+	ld (de), a
+	inc de
+	inc h
+	ld a, (hl)
+	ld (de), a
+	inc de
+	inc h
+	ld a, (hl)
+	ld (de), a
+#endasm
+}
+
+// The old way, a putsprite per glyph, for anything that isn't on a character row.
+void DrawStringSprite(uchar x, uchar y, char* line, uchar * font)
 {
 	int i=0;
-	
-	
 
 	while(line[i] != 0)
 	{
-		if (line[i] != 32)
-		{
-			int a = font[0];
-			int letter = line[i] - a;
-			int toUse = (letter * 10) + 1;
+		uchar letter = line[i] - font[FONT_FIRST];
 
-			//printf("%d %d %d\n",a,letter,toUse);
-			putsprite(spr_or, x, y, font+toUse);			
+		if (line[i] != 32 && letter < font[FONT_GLYPHS])
+		{
+			putsprite(spr_or, x, y, font + FONT_HEADER + (letter * 10));
+			ShadowMarkArea(x >> 3, (x + 7) >> 3, y >> 3, (y + 7) >> 3);
 		}
 		i++;
 		x+=8;
 	}
 }
 
-// Function that will draw an .SCR to screen, including the attributes.
-// this works because of the __FASTCALL__ which pushes the single argument into the HL register.
-// we then load the screen location ($4000) and the screen size (6912) into the needed registers
-// and copy.
-void __FASTCALL__ DrawScrWithAttribs(void* scr)
+// Draw a string on a character row.
+// Each glyph is written over what was there rather than OR'd on, so there's no need to clear first,
+// and anything that would run off the right hand side of the screen is dropped.
+// On a byte boundary the glyphs are copied straight from the font, otherwise they come from the pre-shifted cache.
+void DrawString(uchar x, uchar y, char* line, uchar * font)
+{
+	uchar col = x >> 3;
+	uchar shift = x & 7;
+	uchar count = 0;
+	uchar letter;
+	uchar l;
+	uchar keepLeft;
+	uchar keepRight;
+	uchar saved[8];
+	uchar* screen;
+	uchar* last;
+
+	if (y & 7)
+	{
+		DrawStringSprite(x, y, line, font);
+		return;
+	}
+
+	// A shifted string spills into one more column than it has letters
+	while(line[count] != 0 && col + count + (shift != 0) < 32)
+	{
+		count++;
+	}
+
+	if (count == 0)
+	{
+		return;
+	}
+
+	screen = m_ScreenRows[y] + col;
+
+	if (shift == 0)
+	{
+		for(l = 0; l < count; l++)
+		{
+			letter = line[l] - font[FONT_FIRST];
+			PutChar8(screen + l, letter < font[FONT_GLYPHS] ? font + FONT_HEADER + (letter * 10) + 2 : m_BlankGlyph);
+		}
+
+		ShadowMarkArea(col, col + count - 1, y >> 3, y >> 3);
+		return;
+	}
+
+	if (font != m_FontCacheFont || shift != m_FontCacheShift)
+	{
+		BuildFontCache(font, shift);
+	}
+
+	// Keep the pixels either side of the string that share its end bytes
+	keepLeft = 255 << (8 - shift);
+	keepRight = 255 >> shift;
+	last = screen + count;
+
+	for(l = 0; l < 8; l++)
+	{
+		screen[l << 8] &= keepLeft;
+		saved[l] = last[l << 8] & keepRight;
+	}
+
+	for(l = 0; l < count; l++)
+	{
+		letter = line[l] - font[FONT_FIRST];
+		ShiftedGlyph(screen + l, letter < m_FontCacheGlyphs ? m_FontCache + (letter << 4) : m_BlankGlyph);
+	}
+
+	for(l = 0; l < 8; l++)
+	{
+		last[l << 8] |= saved[l];
+	}
+
+	ShadowMarkArea(col, col + count, y >> 3, y >> 3);
+}
+
+// Copy a whole 32 byte screen line from src to dst.
+// Unrolled LDI's, which are a good bit quicker than an LDIR over the same bytes.
+void CopyLine32(uchar* dst, uchar* src)
 {
 #asm
-	ld de, $4000
-	ld bc, 6912
-	ldir
+	ld hl, 2
+	add hl, sp
+	ld e, (hl)		; de = src
+	inc hl
+	ld d, (hl)
+	inc hl
+	ld a, (hl)		; hl = dst
+	inc hl
+	ld h, (hl)
+	ld l, a
+	ex de, hl		; hl = src, de = dst
+
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
 #endasm
 }
 
-void __FASTCALL__ SetAttribsA(void* scr)
+
+// Retained map of the 32x24 character screen.
+// Drawing code says what a character should look like with SetTile / SetTileAttrib and FlushTiles then
+// writes out only the characters that are actually different to what's on screen.
+// Anything drawn some other way isn't tracked, so call ResetTiles after clearing or redrawing the screen.
+
+// The tile graphics, 8 bytes per tile. Tile 0 should be blank.
+uchar* m_TileBank;
+
+// The tile and attribute each character should have, and the tile that is on screen now.
+uchar m_TileWant[768];
+uchar m_TileShown[768];
+uchar m_TileAttrib[768];
+
+// One bit for each character that has been asked to change since it was last flushed.
+uchar m_TileDirty[96];
+unsigned int m_TileDirtyCount = 0;
+
+// Forget everything, the whole screen is taken to be blank tiles with the attributes it has now
+// (so call it after the screen is cleared), nothing from the last screen gets written back.
+void ResetTiles()
+{
+	memset(m_TileWant, 0, 768);
+	memset(m_TileShown, 0, 768);
+	memcpy(m_TileAttrib, (uchar*)(0x5800), 768);
+	memset(m_TileDirty, 0, 96);
+	m_TileDirtyCount = 0;
+}
+
+void MarkTile(unsigned int t)
+{
+	uchar mask = m_BitMask[t & 7];
+
+	if(!(m_TileDirty[t >> 3] & mask))
+	{
+		m_TileDirty[t >> 3] |= mask;
+		m_TileDirtyCount++;
+	}
+}
+
+void SetTile(uchar col, uchar row, uchar tile, uchar attrib)
+{
+	unsigned int t = ((unsigned int)row << 5) + col;
+
+	m_TileWant[t] = tile;
+	m_TileAttrib[t] = attrib;
+	MarkTile(t);
+}
+
+void SetTileAttrib(uchar col, uchar row, uchar attrib)
+{
+	unsigned int t = ((unsigned int)row << 5) + col;
+
+	m_TileAttrib[t] = attrib;
+	MarkTile(t);
+}
+
+// Write out changed characters from the top of the screen down, stopping after budget of them have been written.
+// Anything left stays marked for the next call.
+void FlushTiles(uchar budget)
+{
+	uchar b, bit, row, col, tile, attrib;
+	unsigned int t;
+	uchar* att;
+
+	for(b = 0; b < 96 && m_TileDirtyCount; b++)
+	{
+		if(!m_TileDirty[b])
+		{
+			continue;
+		}
+
+		t = (unsigned int)b << 3;
+		for(bit = 0; bit < 8; bit++, t++)
+		{
+			if(!(m_TileDirty[b] & m_BitMask[bit]))
+			{
+				continue;
+			}
+
+			if(budget == 0)
+			{
+				return;
+			}
+
+			m_TileDirty[b] &= ~m_BitMask[bit];
+			m_TileDirtyCount--;
+
+			row = t >> 5;
+			col = t & 31;
+			tile = m_TileWant[t];
+			attrib = m_TileAttrib[t];
+			att = m_AttribRows[row] + col;
+
+			if(tile == m_TileShown[t] && *att == attrib)
+			{
+				continue;
+			}
+
+			// Pixels under an attribute with the same ink and paper can't be seen, so they can wait.
+			if(tile != m_TileShown[t] && (attrib & 7) != ((attrib >> 3) & 7))
+			{
+				PutChar8(m_ScreenRows[row << 3] + col, m_TileBank + (tile << 3));
+				m_TileShown[t] = tile;
+			}
+
+			*att = attrib;
+			ShadowMark(col, row);
+			budget--;
+		}
+	}
+}
+
+// Unpack ZX7 data from src to dst.
+// This is Einar Saukas' standard dzx7 decompressor, the data is packed at build time (see compiler.ps1).
+// The decompressor is under the ZX7 licence:
+//
+// ZX7 decoder by Einar Saukas, Antonio Villena & Metalbrain, "Standard" version.
+// Copyright (c) 2012-2016, Einar Saukas
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * The name of its author may not be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+void Unpack(uchar* src, uchar* dst)
 {
 #asm
-	ld de, $5800
-	ld bc, 768
+	ld hl, 2
+	add hl, sp
+	ld e, (hl)		; de = dst
+	inc hl
+	ld d, (hl)
+	inc hl
+	ld a, (hl)		; hl = src
+	inc hl
+	ld h, (hl)
+	ld l, a
+
+	ld a, $80
+.dzx7s_copy_byte_loop
+	ldi				; copy literal byte
+.dzx7s_main_loop
+	call dzx7s_next_bit
+	jr nc, dzx7s_copy_byte_loop	; next bit indicates either literal or sequence
+
+	; determine number of bits used for length (Elias gamma coding)
+	push de
+	ld bc, 0
+	ld d, b
+.dzx7s_len_size_loop
+	inc d
+	call dzx7s_next_bit
+	jr nc, dzx7s_len_size_loop
+
+	; determine length
+.dzx7s_len_value_loop
+	call nc, dzx7s_next_bit
+	rl c
+	rl b
+	jr c, dzx7s_exit		; check end marker
+	dec d
+	jr nz, dzx7s_len_value_loop
+	inc bc				; adjust length
+
+	; determine offset
+	ld e, (hl)			; load offset flag (1 bit) + offset value (7 bits)
+	inc hl
+	defb $cb, $33			; opcode for undocumented instruction "SLL E"
+	jr nc, dzx7s_offset_end		; if offset flag is set, load 4 extra bits
+	ld d, $10			; bit marker to load 4 bits
+.dzx7s_rld_next_bit
+	call dzx7s_next_bit
+	rl d				; insert next bit into D
+	jr nc, dzx7s_rld_next_bit	; repeat 4 times, until bit marker is out
+	inc d				; add 128 to DE
+	srl d				; retrieve fourth bit from D
+.dzx7s_offset_end
+	rr e				; insert fourth bit into E
+
+	; copy previous sequence
+	ex (sp), hl			; store source, restore destination
+	push hl				; store destination
+	sbc hl, de			; HL = destination - offset - 1
+	pop de				; DE = destination
 	ldir
+.dzx7s_exit
+	pop hl				; restore source address (compressed data)
+	jr nc, dzx7s_main_loop
+	jr dzx7s_done
+
+.dzx7s_next_bit
+	add a, a			; check next bit
+	ret nz				; no more bits left?
+	ld a, (hl)			; load another group of 8 bits
+	inc hl
+	rla
+	ret
+
+.dzx7s_done
 #endasm
 }
 
+// Copy count rows of attributes from an attribute image (768 bytes, laid out like the screen's),
+// starting at row first. 32 unrolled LDI's a row, so the whole lot is about 12K T-states,
+// which is less than the time between the interrupt and the beam reaching the first line.
+void CopyAttribRows(uchar* src, uchar first, uchar count)
+{
+#asm
+	ld hl, 2
+	add hl, sp
+	ld c, (hl)		; c = count
+	inc hl
+	inc hl
+	ld a, (hl)		; a = first
+	inc hl
+	inc hl
+	ld e, (hl)		; de = src
+	inc hl
+	ld d, (hl)
 
-// the ASM call halt will block the code till the next frame is about to start.
-// useful for trying to work with in a redraw frame.
-void Halt()
+	ld l, a			; hl = first * 32
+	ld h, 0
+	add hl, hl
+	add hl, hl
+	add hl, hl
+	add hl, hl
+	add hl, hl
+	push hl
+	add hl, de		; hl = src + first * 32
+	pop de
+	ld a, d			; de = $5800 + first * 32
+	add a, $58
+	ld d, a
+
+	ld a, c
+	or a
+	jr z, copyattribrows_done
+.copyattribrows_loop
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	ldi
+	dec a
+	jr nz, copyattribrows_loop
+.copyattribrows_done
+#endasm
+	ShadowMarkArea(0, 31, first, first + count - 1);
+}
+
+// Copy a whole screen's worth of attributes from scr.
+void SetAttribsA(void* scr)
+{
+	CopyAttribRows(scr, 0, 24);
+}
+
+
+// Keyboard. The frame interrupt reads the half rows straight off port $FE and puts key presses
+// in m_KeyQueue, so nothing pressed while the game is busy (or beeping) gets lost.
+// Codes are the same as getk() gives, caps shift + 5678 are the arrows (8, 10, 11, 9).
+// A key held down repeats after KEY_REPEAT_DELAY frames, then every KEY_REPEAT_RATE, apart from space
+// which is what puts an atom down.
+// A key only counts as let go once it has been up for two frames running, which is the debounce.
+#define KEY_QUEUE_SIZE 16	// Has to be a power of 2
+#define KEY_REPEAT_DELAY 20
+#define KEY_REPEAT_RATE 4
+
+// A code for each key, half row by half row ($FEFE first) from the outside key in.
+// The second 40 are with caps shift held, caps and symbol shift themselves are 0.
+uchar m_KeyMap[80] =
+{
+	0, 'z', 'x', 'c', 'v',		'a', 's', 'd', 'f', 'g',
+	'q', 'w', 'e', 'r', 't',	'1', '2', '3', '4', '5',
+	'0', '9', '8', '7', '6',	'p', 'o', 'i', 'u', 'y',
+	13, 'l', 'k', 'j', 'h',		' ', 0, 'm', 'n', 'b',
+
+	0, 'Z', 'X', 'C', 'V',		'A', 'S', 'D', 'F', 'G',
+	'Q', 'W', 'E', 'R', 'T',	7, 6, 4, 5, 8,
+	12, 15, 9, 11, 10,		'P', 'O', 'I', 'U', 'Y',
+	13, 'L', 'K', 'J', 'H',		' ', 0, 'M', 'N', 'B'
+};
+
+uchar m_KeyQueue[KEY_QUEUE_SIZE];
+uchar m_KeyHead = 0;		// Next one to read
+uchar m_KeyTail = 0;		// Next free, the interrupt is the only thing that moves this
+uchar m_KeyHeld = 0;		// Code of the key held down, 0 for none
+uchar m_KeyRepeat = 0;		// Frames till the held key goes in again
+uchar m_KeyUp = 0;		// Frames with nothing pressed
+
+// Take the next key press off the queue, 0 if there isn't one.
+uchar ReadKey()
+{
+	uchar k;
+
+	if (m_KeyHead == m_KeyTail)
+	{
+		return 0;
+	}
+
+	k = m_KeyQueue[m_KeyHead];
+	m_KeyHead = (m_KeyHead + 1) & (KEY_QUEUE_SIZE - 1);
+	return k;
+}
+
+// Have a look at the next key press without taking it.
+uchar PeekKey()
+{
+	if (m_KeyHead == m_KeyTail)
+	{
+		return 0;
+	}
+
+	return m_KeyQueue[m_KeyHead];
+}
+
+// Throw away anything pressed so far.
+void FlushKeys()
+{
+	m_KeyHead = m_KeyTail;
+}
+
+// Joysticks. The frame interrupt reads each one that's been picked into m_JoyState, all in the
+// Kempston layout. Sinclair 1 is the 6-0 keys and Sinclair 2 is 1-5, read straight off their half rows.
+// Only read what's in m_JoyUsed, with no Kempston interface port $1F reads whatever's on the bus.
+#define INPUT_KEYS 0
+#define INPUT_KEMPSTON 1
+#define INPUT_SINCLAIR1 2
+#define INPUT_SINCLAIR2 3
+#define INPUT_DEVICES 4
+
+#define JOY_RIGHT 1
+#define JOY_LEFT 2
+#define JOY_DOWN 4
+#define JOY_UP 8
+#define JOY_FIRE 16
+
+uchar m_JoyState[INPUT_DEVICES];
+uchar m_JoyUsed = 0;			// A bit for each device to read, (1 << INPUT_KEMPSTON) and so on
+uchar m_KeyRowsOff = 0;			// Half rows left out of the key queue, a bit each like the row's port address
+uchar m_JoyLast[INPUT_DEVICES];
+
+// Pick the devices to read (a bit for each, as m_JoyUsed). A Sinclair stick is keys on the keyboard,
+// so its half row is left out of the key queue while it's in use, or it would move anyone on the keys too.
+void UseJoysticks(uchar used)
+{
+	uchar rows = 0;
+
+	if (used & (1 << INPUT_SINCLAIR1))
+	{
+		rows |= 0x10;		// $EFFE, 6 to 0
+	}
+	if (used & (1 << INPUT_SINCLAIR2))
+	{
+		rows |= 0x08;		// $F7FE, 1 to 5
+	}
+
+	m_JoyUsed = used;
+	m_KeyRowsOff = rows;
+}
+uchar m_JoyRepeat[INPUT_DEVICES];
+
+// Turn a joystick into key codes, so it can drive anything that takes keys.
+// Call once a frame. A new direction or fire comes out straight away, a held direction repeats like a key.
+uchar ReadJoystick(uchar device)
+{
+	uchar state = m_JoyState[device];
+	uchar fresh = state & ~m_JoyLast[device];
+
+	m_JoyLast[device] = state;
+
+	if (fresh)
+	{
+		m_JoyRepeat[device] = KEY_REPEAT_DELAY;
+	}
+	else
+	{
+		if (!(state & ~JOY_FIRE) || --m_JoyRepeat[device])
+		{
+			return 0;
+		}
+
+		fresh = state & ~JOY_FIRE;
+		m_JoyRepeat[device] = KEY_REPEAT_RATE;
+	}
+
+	if (fresh & JOY_FIRE)
+	{
+		return ' ';
+	}
+	if (fresh & JOY_UP)
+	{
+		return 11;
+	}
+	if (fresh & JOY_DOWN)
+	{
+		return 10;
+	}
+	if (fresh & JOY_LEFT)
+	{
+		return 8;
+	}
+	if (fresh & JOY_RIGHT)
+	{
+		return 9;
+	}
+	return 0;
+}
+
+// Sound. PlaySound() puts an effect on m_SoundQueue and the frame interrupt plays it a step a frame,
+// so nothing ever waits on a sound. On a 128K it goes out of the AY (channel A) and plays for the whole frame.
+// The 48K beeper only sounds while the CPU is toggling it, so the interrupt can only give it a slice of
+// each frame (SOUND_SLICE, about 4000 T-states or 6% of the frame) and it's quiet for the rest. That
+// gives a buzz with the pitch in it rather than a clean tone, but it never holds up the game. Anything
+// bigger comes straight out of the time the chain reaction and AI get each frame.
+// Where holding up the game costs nothing (starting a game, leaving the winner screen) use PlaySoundNow,
+// which on a 48K plays the effect on the beeper for the whole of each frame and waits for it.
+// An effect is pairs of bytes, pitch then level, one pair a frame, ending with a pitch of 0.
+// Pitch is the tone (bigger is lower), level is the volume 0 to 15 (0 is a rest), add SOUND_NOISE for noise.
+#define SOUND_QUEUE_SIZE 8	// Has to be a power of 2
+#define SOUND_NOISE 16
+#define SOUND_SLICE 300		// The interrupt's beeper slice, in 13 T-state units
+#define SOUND_FRAME_SLICE 4000	// Near enough a whole frame (the loop takes a bit more than it counts)
+
+uchar* m_SoundQueue[SOUND_QUEUE_SIZE];
+uchar m_SoundHead = 0;
+uchar m_SoundTail = 0;		// Only PlaySound moves this
+uchar* m_SoundPos = 0;		// Where the interrupt is in the effect playing, 0 for nothing
+uchar m_HasAY = 0;
+uchar m_BeeperBorder = 0;	// Border colour, the beeper shares its port
+
+// Queue an effect. If the same one is already waiting it isn't queued again, so something
+// asked for every frame doesn't pile up behind itself, and if the queue is full it's dropped.
+void PlaySound(uchar* effect)
+{
+	uchar next = (m_SoundTail + 1) & (SOUND_QUEUE_SIZE - 1);
+
+	if (m_SoundHead != m_SoundTail && m_SoundQueue[(m_SoundTail - 1) & (SOUND_QUEUE_SIZE - 1)] == effect)
+	{
+		return;
+	}
+
+	if (next == m_SoundHead)
+	{
+		return;
+	}
+
+	m_SoundQueue[m_SoundTail] = effect;
+	m_SoundTail = next;
+}
+
+// Queue an effect only if nothing is already waiting behind the one playing. For sounds asked for
+// every frame, like the chain reaction's, which would otherwise back up and lag behind what's on screen.
+void PlaySoundIfQuiet(uchar* effect)
+{
+	if (m_SoundHead == m_SoundTail)
+	{
+		PlaySound(effect);
+	}
+}
+
+// One frame's worth of an effect on the beeper for PlaySoundNow, a rest just waits for the frame.
+void BeepFrame(uchar pitch, uchar level)
+{
+#asm
+	ld hl, 2
+	add hl, sp
+	ld e, (hl)		; e = level
+	inc hl
+	inc hl
+	ld d, (hl)		; d = pitch
+	ld a, e
+	and $0F
+	jr nz, beep_frame_tone
+	halt
+	ret
+.beep_frame_tone
+	ld hl, SOUND_FRAME_SLICE
+	jp sound_beep
+#endasm
+}
+
+// Play an effect and, on a 48K, wait for it to finish so the beeper gets whole frames (see above).
+// Whatever the interrupt was playing is dropped so the two don't fight over the speaker.
+// With an AY nothing has to wait, so it's just queued.
+void PlaySoundNow(uchar* effect)
+{
+	if (m_HasAY)
+	{
+		PlaySound(effect);
+		return;
+	}
+
+#asm
+	di
+#endasm
+	m_SoundHead = m_SoundTail;
+	m_SoundPos = 0;
+#asm
+	ei
+#endasm
+
+	while (*effect)
+	{
+		BeepFrame(effect[0], effect[1]);
+		effect += 2;
+	}
+}
+
+// Set the border, and keep the beeper from changing it back.
+void SetBorder(uchar colour)
+{
+	m_BeeperBorder = colour;
+	zx_border(colour);
+}
+
+// See if there's an AY by writing to a register and reading it back, twice in case of a fluke off the bus.
+uchar HasAY()
+{
+#asm
+	di
+	ld bc, $FFFD
+	xor a			; register 0, channel A fine tone
+	out (c), a
+	ld b, $BF
+	ld a, $5A
+	out (c), a
+	ld b, $FF
+	in a, (c)
+	ld hl, 0
+	cp $5A
+	jr nz, hasay_no
+	ld b, $BF
+	ld a, $A5
+	out (c), a
+	ld b, $FF
+	in a, (c)
+	cp $A5
+	jr nz, hasay_no
+	inc l
+.hasay_no
+	ei
+#endasm
+}
+
+// Frame interrupt. The Spectrum interrupts 50 times a second as the beam heads back to the top.
+// In IM 2 this replaces the ROM's handler, it scans the keyboard, plays sound, counts frames and keeps FRAMES
+// going so clock() still works. getk() won't see anything any more, use ReadKey().
+// The vector table is $BE00-$BF00, all $BD, so whatever is on the bus we end up at $BDBD
+// where there's a jump to frame_isr. It's kept below $C000 so I never points at contended RAM
+// (that gives snow, and worse on a 128K) and the table is there whichever bank is paged in at $C000.
+// The code, data and variables have to finish below $BDBD for this to work,
+// so that's checked first and if they don't the border goes red and it stops there.
+unsigned int m_FrameCount = 0;		// Goes up every interrupt
+unsigned int m_FrameShown = 0;		// m_FrameCount when the last wait finished
+unsigned int m_FramesDropped = 0;	// Frames that went by while a step was running over
+uchar m_FrameLate = 0;			// The last step ran over, so the last wait didn't wait
+
+// The interrupt code itself. It's not a function, nothing calls it but the interrupt, so it
+// sits in its own asm block where SetupFrameInterrupt doesn't have to jump over it.
+#asm
+.frame_isr
+	push af
+	push bc
+	call frame_isr_work
+	pop bc
+	pop af
+	ei
+	reti
+
+.frame_isr_work
+	push de
+	push hl
+
+	; Find the first key down, d = its code. Caps shift picks the second half of the map.
+	ld hl, _m_KeyMap
+	ld bc, $FEFE
+	in a, (c)
+	rra
+	jr c, key_scan_row
+	ld de, 40
+	add hl, de
+.key_scan_row
+	ld d, 0
+.key_scan_next_row
+	ld a, (_m_KeyRowsOff)	; the row bit is 0 in b, so this is $FF if the row is a stick
+	or b
+	inc a
+	jr z, key_scan_row_off
+	in a, (c)
+	cpl
+.key_scan_row_off
+	ld e, 5
+.key_scan_bit
+	rra
+	jr nc, key_scan_next
+	inc d
+	dec d
+	jr nz, key_scan_next	; already got one
+	ld d, (hl)
+.key_scan_next
+	inc hl
+	dec e
+	jr nz, key_scan_bit
+	rlc b			; next half row, $7F is the last
+	jr c, key_scan_next_row
+
+	ld a, d
+	or a
+	jr nz, key_down
+
+	; Nothing down, the held key is let go once it has been up for two frames.
+	ld hl, _m_KeyUp
+	inc (hl)
+	jr nz, key_up_counted
+	dec (hl)
+.key_up_counted
+	ld a, (hl)
+	cp 2
+	jr c, key_done
+	xor a
+	ld (_m_KeyHeld), a
+	jr key_done
+
+.key_down
+	xor a
+	ld (_m_KeyUp), a
+	ld a, (_m_KeyHeld)
+	cp d
+	jr z, key_same
+	ld a, d
+	ld (_m_KeyHeld), a
+	ld a, KEY_REPEAT_DELAY
+	ld (_m_KeyRepeat), a
+	jr key_push
+
+.key_same
+	ld a, d
+	cp 32			; space puts an atom down, holding it must not put one down for the next player too
+	jr z, key_done
+	ld hl, _m_KeyRepeat
+	dec (hl)
+	jr nz, key_done
+	ld (hl), KEY_REPEAT_RATE
+
+.key_push
+	ld a, (_m_KeyTail)
+	ld e, a
+	inc a
+	and KEY_QUEUE_SIZE - 1
+	ld hl, _m_KeyHead
+	cp (hl)
+	jr z, key_done		; full up, the game is not reading them
+	ld hl, _m_KeyQueue
+	ld b, 0
+	ld c, e
+	add hl, bc
+	ld (hl), d
+	ld (_m_KeyTail), a
+
+.key_done
+	; Joysticks, just the ones in use.
+	ld a, (_m_JoyUsed)
+	ld e, a
+	bit INPUT_KEMPSTON, e
+	jr z, joy_no_kempston
+	in a, ($1F)
+	and $1F
+	ld (_m_JoyState + INPUT_KEMPSTON), a
+.joy_no_kempston
+	bit INPUT_SINCLAIR1, e
+	jr z, joy_no_sinclair1
+	ld bc, $EFFE
+	ld hl, joy_sinclair1_bits
+	call joy_read
+	ld (_m_JoyState + INPUT_SINCLAIR1), a
+.joy_no_sinclair1
+	bit INPUT_SINCLAIR2, e
+	jr z, joy_no_sinclair2
+	ld bc, $F7FE
+	ld hl, joy_sinclair2_bits
+	call joy_read
+	ld (_m_JoyState + INPUT_SINCLAIR2), a
+.joy_no_sinclair2
+
+	call sound_frame
+
+	ld hl, (_m_FrameCount)
+	inc hl
+	ld (_m_FrameCount), hl
+
+	; Keep FRAMES going for clock(), that is all the ROM handler would still be doing for us.
+	ld hl, ($5C78)
+	inc hl
+	ld ($5C78), hl
+	ld a, h
+	or l
+	jr nz, frames_done
+	ld hl, $5C7A
+	inc (hl)
+.frames_done
+
+	pop hl
+	pop de
+	ret
+
+; Read the half row in bc, hl = the JOY_ bit for each of its keys from the outside in. a = the lot.
+.joy_read
+	in a, (c)
+	cpl
+	ld b, a
+	ld c, 5
+	ld d, 0
+.joy_read_bit
+	rr b
+	jr nc, joy_read_next
+	ld a, d
+	or (hl)
+	ld d, a
+.joy_read_next
+	inc hl
+	dec c
+	jr nz, joy_read_bit
+	ld a, d
+	ret
+
+; Play a frame of sound, starting the next effect off the queue if nothing is playing.
+.sound_frame
+	ld hl, (_m_SoundPos)
+	ld a, h
+	or l
+	jr nz, sound_playing
+	ld a, (_m_SoundHead)
+	ld hl, _m_SoundTail
+	cp (hl)
+	jr z, sound_quiet
+	ld e, a
+	inc a
+	and SOUND_QUEUE_SIZE - 1
+	ld (_m_SoundHead), a
+	ld d, 0
+	ld hl, _m_SoundQueue
+	add hl, de
+	add hl, de
+	ld a, (hl)
+	inc hl
+	ld h, (hl)
+	ld l, a
+.sound_playing
+	ld d, (hl)		; d = pitch, 0 is the end
+	inc d
+	dec d
+	jr z, sound_end
+	inc hl
+	ld e, (hl)		; e = level
+	inc hl
+	ld (_m_SoundPos), hl
+	ld a, (_m_HasAY)
+	or a
+	jr z, sound_beeper
+
+	; AY channel A, tone period pitch * 4, noise period pitch / 8.
+	ld bc, $FFFD
+	xor a
+	out (c), a
+	ld b, $BF
+	ld a, d
+	add a, a
+	add a, a
+	out (c), a
+	ld b, $FF
+	ld a, 1
+	out (c), a
+	ld b, $BF
+	ld a, d
+	rlca
+	rlca
+	and 3
+	out (c), a
+	ld b, $FF
+	ld a, 6
+	out (c), a
+	ld b, $BF
+	ld a, d
+	rrca
+	rrca
+	rrca
+	and $1F
+	out (c), a
+	ld b, $FF
+	ld a, 7			; mixer, just tone or just noise on A
+	out (c), a
+	ld b, $BF
+	ld a, e
+	and SOUND_NOISE
+	ld a, $3E
+	jr z, sound_ay_tone
+	ld a, $37
+.sound_ay_tone
+	out (c), a
+	ld b, $FF
+	ld a, 8
+	out (c), a
+	ld b, $BF
+	ld a, e
+	and $0F
+	out (c), a
+	ret
+
+.sound_end
+	ld hl, 0
+	ld (_m_SoundPos), hl
+.sound_quiet
+	ld a, (_m_HasAY)
+	or a
+	ret z
+	ld bc, $FFFD
+	ld a, 8			; channel A volume off
+	out (c), a
+	ld b, $BF
+	xor a
+	out (c), a
+	ret
+
+; 48K, a slice of the frame on the beeper.
+.sound_beeper
+	ld hl, SOUND_SLICE
+
+; Beeper, flip the speaker every pitch * 13 T-states (or a random bit less for noise)
+; till hl lots of 13 T-states are used up. d = pitch, e = level. BeepFrame comes in here too.
+.sound_beep
+	ld a, e
+	and $0F
+	ret z
+	ld a, e
+	and SOUND_NOISE
+	rlca
+	rlca
+	rlca			; the noise flag goes in bit 7, the ULA takes no notice of it
+	ld c, a
+	ld a, (_m_BeeperBorder)
+	or c
+	ld c, a			; c = what goes out to port $FE
+	ld e, d
+	ld d, 0			; de = pitch
+.sound_beep_wave
+	ld a, c
+	xor $10
+	ld c, a
+	out ($FE), a
+	ld b, e
+	bit 7, c
+	jr z, sound_beep_delay
+	ld a, r
+	and e
+	or 1
+	ld b, a
+.sound_beep_delay
+	djnz sound_beep_delay
+	and a
+	sbc hl, de
+	jr nc, sound_beep_wave
+	ld a, c
+	and 7			; speaker off, just the border
+	out ($FE), a
+	ret
+
+.joy_sinclair1_bits		; 0 9 8 7 6
+	defb JOY_FIRE, JOY_UP, JOY_DOWN, JOY_RIGHT, JOY_LEFT
+.joy_sinclair2_bits		; 1 2 3 4 5
+	defb JOY_LEFT, JOY_RIGHT, JOY_DOWN, JOY_UP, JOY_FIRE
+#endasm
+
+void SetupFrameInterrupt()
+{
+#asm
+	EXTERN __BSS_END_tail
+
+	di
+	ld hl, __BSS_END_tail	; first byte after the program and its variables
+	ld de, $BDBE
+	and a
+	sbc hl, de
+	jr c, frame_fits
+
+	ld a, 2			; red border, the table would go over the program
+	out ($FE), a
+	halt
+
+.frame_fits
+	ld hl, $BE00
+	ld de, $BE01
+	ld bc, 256
+	ld (hl), $BD
+	ldir
+
+	ld a, $C3		; jp frame_isr
+	ld ($BDBD), a
+	ld hl, frame_isr
+	ld ($BDBE), hl
+
+	ld a, $BE
+	ld i, a
+	im 2
+	ei
+#endasm
+}
+
+// Wait till frames have gone by since the last wait finished, this keeps the game to a fixed step.
+// If the step in between ran over and the frame has already come, don't wait at all
+// (that's the frame skip), m_FrameLate says so and the frames that were missed are counted.
+// Interrupts are off while checking so one can't sneak in between the check and the halt.
+void WaitFrames(uchar frames)
 {
+	m_FrameLate = 1;
 #asm
+	di
+#endasm
+	while (m_FrameCount - m_FrameShown < frames)
+	{
+		m_FrameLate = 0;
+#asm
+	ei
 	halt
+	di
+#endasm
+	}
+#asm
+	ei
 #endasm
+
+	if (m_FrameLate)
+	{
+		m_FramesDropped += m_FrameCount - m_FrameShown - frames;
+	}
+	m_FrameShown = m_FrameCount;
+
+#ifdef DOUBLE_BUFFER
+	PresentScreen();
+#endif
+}
+
+// Wait for the next frame, useful for trying to work with in a redraw frame.
+// With double buffering this is also where the finished frame goes on show.
+void Halt()
+{
+	WaitFrames(1);
+}
+
+// Wait for the next frame to start, even if the last step ran over (where Halt() wouldn't wait at all).
+// For the odd screen change outside a phase that has to start with the beam at the top.
+void SyncFrame()
+{
+	m_FrameShown = m_FrameCount;
+	WaitFrames(1);
+}
+
+// Runs a phase of the game (menu, input, chain reaction...) as a step per frame, till the step returns 0.
+// budget is how many frames each step gets, anything a step doesn't finish in that
+// shows up as m_FrameLate to the next one.
+void RunPhase(uchar (*step)(), uchar budget)
+{
+	do
+	{
+		WaitFrames(budget);
+	} while (step());
+}
+
+// Attributes are unpacked here before going on the screen all at once.
+uchar m_AttribBuffer[768];
+
+// Unpack a .SCR, the pixels and attributes are packed separately (see compiler.ps1).
+// The pixels go straight on the screen under black attributes so you can't see them going in,
+// and the attributes go in m_AttribBuffer so anything else can be painted on them first.
+// Then CopyAttribRows(m_AttribBuffer, 0, 24) straight after an interrupt puts them on all at once,
+// which beats the beam down the screen.
+// The clear keeps interrupts off for over half a frame, so it starts straight after one or it would swallow the next.
+void UnpackScr(void* pixels, void* attribs)
+{
+	SyncFrame();
+	FillScreen(0, 0);
+	Unpack(pixels, (uchar*)(0x4000));
+	Unpack(attribs, m_AttribBuffer);
 }
 
 #endif
\ No newline at end of file
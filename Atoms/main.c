@@ -28,14 +28,18 @@
 #include <spectrum.h>
 #include <graphics.h>
 #include <games.h>
-#include <sound.h>
 #include <time.h>
 
 #include <stdio.h>
 #include <stdlib.h> 
 
+// The HUD is the only text drawn off a character boundary, and it's in Font2, so the cache only needs its 75 glyphs.
+#define FONT_CACHE_GLYPHS 75
+
 #include "SentiaZX.h"
 
+#include "topology.h"
+
 #include "sprites.h"
 
 int LastCursorX=0;
@@ -59,8 +63,15 @@ uchar m_AttribPlayerMap[5];
 // lazy array to map the sprites to their sizes.
 char* m_Atoms[4];
 
-// Holds the number of atoms that player has (including no player 0), and thus is a cheaty way to work out of the player is alive.
-uchar m_Alive[5];
+// Live count of the squares each player owns (player 0 is empty squares).
+// Kept up to date as squares change hands so nothing has to recount the grid,
+// a player with none left is out of the game.
+uchar m_Owned[5];
+
+// How many players have any squares, and set as soon as a capture leaves just one of them
+// (after the first round, when everyone has had a go). Nobody can come back from that.
+uchar m_PlayersLeft = 0;
+uchar m_GameDecided = 0;
 
 uchar m_CurrentPlayer;
 uchar m_GameFinished = 0;
@@ -68,159 +79,184 @@ uchar m_GameFinished = 0;
 // 0 for not player, 1 for Human, 2 For AI
 uchar m_PlayerSetup[5];
 
-
-struct GridSquare
-{
-	uchar Player;
-	uchar Size;
-	uchar GrowSize;
-	uchar Changed;
-	uchar MaxSize;
-} m_PlayerGrid[70];
+// What each player moves with, one of the INPUT_ devices. Picked on the menu with the keys in m_InputKeys.
+uchar m_PlayerInput[5];
+char m_InputNames[INPUT_DEVICES] = { 'k', 'j', '1', '2' };
+char m_InputKeys[] = "qwer";
+
+
+// The board, a byte array for each thing we need to know about a square (indexed by GridIndex).
+// Player and Size are the real state of the board, the rest only mean anything while AnimateScreen is running.
+// How many atoms a square can hold comes from m_Topology.
+uchar m_GridPlayer[GRID_SQUARES];
+uchar m_GridSize[GRID_SQUARES];
+uchar m_GridGrow[GRID_SQUARES];		// atoms waiting to be added
+uchar m_GridChanged[GRID_SQUARES];	// needs drawing or exploding
+uchar m_GridQueued[GRID_SQUARES];	// on the active list
+
+// Squares that still have work to do (growing, redrawing or waiting to explode).
+// The list is kept in grid order so walking it visits squares in the same order a full scan would,
+// which keeps chain reactions playing out exactly as they always have.
+uchar m_ActiveCells[GRID_SQUARES];
+uchar m_ActiveCount = 0;
+
+// Where AnimateScreen is in the active list.
+uchar m_ActivePos = 0;
+
+// How many generations (steps of the chain reaction) the last AnimateScreen ran for.
+unsigned int m_Generations = 0;
+
+// Animation speed, how many generations go by for each frame that's shown.
+// Picked on the menu, the tile map only keeps the latest look of each square so skipped ones cost nothing to draw.
+#define ANIM_SPEEDS 3
+uchar m_AnimSpeeds[ANIM_SPEEDS] = { 1, 2, 8 };
+char* m_AnimSpeedNames[ANIM_SPEEDS] = { "s speed: normal", "s speed: quick ", "s speed: fast  " };
+uchar m_AnimSpeedSetting = 0;
+
+// Sound effects for PlaySound, a pitch and level for each frame.
+// Keep the pitches well under SOUND_SLICE or a frame's burst on the 48K beeper is only a click or two.
+uchar m_SoundMove[] = { 24, 12, 0 };
+uchar m_SoundGrow[] = { 60, 10, 0 };
+uchar m_SoundExplode[] = { 40, 15 | SOUND_NOISE, 64, 12 | SOUND_NOISE, 96, 8 | SOUND_NOISE, 0 };
+uchar m_SoundStart[] = { 80, 14, 64, 14, 48, 14, 32, 14, 24, 12, 16, 10, 0 };
+
+// A chain reaction is given up on after this many generations, or if it gets back to a state it has been in before.
+// Neither should happen as the game is decided before the board can fill up, but it keeps the worst case turn bounded.
+// Loops are looked for with Brent's method, the state is saved at 64, 128, 256... generations and compared against.
+#define MAX_GENERATIONS 1000
+#define CYCLE_CHECK_FROM 64
+
+uchar m_CycleState[GRID_SQUARES * 4];
+unsigned int m_CycleSaveAt;
+
+// How many characters FlushRender will write in one frame (4 to a square), anything else waits for the next one.
+#define RENDER_BUDGET 48
+
+// Attribute only effects on squares (explosions and captures), put on by FlushRender.
+// Each one works through a colour cycle, a list of attributes (one a frame) ending in EFFECT_END,
+// then the square goes back to whatever the tile map says it should be.
+// They're timed off m_FrameCount rather than by how often they're stepped, so a step that runs over
+// doesn't hold them up, they just skip ahead to the colour they should be on.
+// The cycles are all solid colours (ink the same as paper) so it doesn't matter what pixels are under them.
+#define MAX_EFFECTS 16
+#define EFFECT_END 255
+
+uchar m_EffectCell[MAX_EFFECTS];
+uchar* m_EffectCycle[MAX_EFFECTS];
+unsigned int m_EffectStart[MAX_EFFECTS];	// m_FrameCount when it was started
+uchar m_EffectCount = 0;
+
+uchar m_ExplodeCycle[] = {
+	PAPER_WHITE | INK_WHITE | BRIGHT, PAPER_WHITE | INK_WHITE | BRIGHT,
+	PAPER_YELLOW | INK_YELLOW | BRIGHT, PAPER_YELLOW | INK_YELLOW | BRIGHT,
+	PAPER_RED | INK_RED | BRIGHT, PAPER_RED | INK_RED,
+	EFFECT_END };
+
+// Filled in by SetupDefaults from the player colours, a white flash then the new owner's colour.
+uchar m_CaptureCycle[5][5];
 
 // to move a grid square to a screen location its x *24, or x * 8 + x * 16 (which simplifies to x << 8 + x << 16).
 // This could be made faster with a table lookup.
 // This is a macro because its going to be used in a number of loops and it saves on jmp's with a funciton call
 #define GridToScreen(z) (z << 3) + (z << 4)
 
-// Draw the grid onscreen, 1 8x8 block at a time :/
-// The screen should be empty so we can just OR the data directly to the screen.
+// Draw the grid onscreen.
+// Every line of the grid is either just the vertical bars or the line where the horizontal bars cross them,
+// the crossing lines are the 4th and 5th line of every 24 (see GridLineBars / GridLineCross in sprites.h).
+// So it's just a case of copying the right line down the screen, rather than building it from hundreds of sprites.
 void DrawGrid()
 {
-	int x = 0;
-	int y = 0;
-
-	
+	uchar y;
+	uchar line = 0;
 
-	for(y=0;y<7;y++)
+	for(y = 0; y < 176; y++)
 	{
-		for(x = 0;x<11;x++)
+		if(line == 3 || line == 4)
 		{
-			putsprite(spr_or, GridToScreen(x) , GridToScreen(y) + 8, sprite0);
-			putsprite(spr_or, GridToScreen(x) , GridToScreen(y) + 16, sprite0);
+			CopyLine32(m_ScreenRows[y], GridLineCross);
 		}
-	}
-
-	for(x = 0;x<10;x++)
-	{
-		for(y=0;y<8;y++)
+		else
 		{
-			putsprite(spr_or, GridToScreen(x) + 8, GridToScreen(y), sprite1);
-			putsprite(spr_or, GridToScreen(x) + 16, GridToScreen(y), sprite1);
+			CopyLine32(m_ScreenRows[y], GridLineBars);
 		}
-	}
 
-
-	for(x = 0;x<11;x++)
-	{
-		for(y=0;y<8;y++)
+		line++;
+		if(line == 24)
 		{
-			putsprite(spr_or, GridToScreen(x), GridToScreen(y),sprite2);
+			line = 0;
 		}
 	}
+
+	ShadowMarkAll();
 }
 
-// Draw the cursor, but first reset the previous cursor back to being the grid.
+// Where the 8 parts of the cursor go, in characters from the top left corner of the square.
+// In the same order as CursorImage in sprites.h.
+uchar CursorPartX[] = { 0, 0, 3, 3, 1, 2, 1, 2 };
+uchar CursorPartY[] = { 1, 2, 1, 2, 0, 0, 3, 3 };
+
+// Whatever was on screen under the cursor, so it can be put back when the cursor moves on.
+uchar m_CursorSavePixels[64];
+uchar m_CursorSaveAttribs[8];
+
+// Is the cursor on screen, and the character column / row of the top left of where it is.
+uchar m_CursorShown = 0;
+uchar m_CursorCol = 0;
+uchar m_CursorRow = 0;
+
+// Draw the cursor, but first put back whatever was under the previous cursor.
 // The force is there so we can force the drawing of the cursor even if it hasn't moved.
-// Useful for the first draw and player changes.
+// Useful for the first draw and player changes, if it hasn't moved only the colour needs changing.
 void DrawCursor(int force)
 {
-	if(LastCursorX != CursorX || LastCursorY != CursorY || force)
+	if(LastCursorX != CursorX || LastCursorY != CursorY || force || !m_CursorShown)
 	{
-		int cursorXBase = (CursorX*8)+(CursorX*16);
-		int cursorYBase = (CursorY*8)+(CursorY*16);
-		int attribX = cursorXBase >> 3;
-		int attribY = cursorYBase >> 3;
-
-
-		int lastxBase = (LastCursorX*8)+(LastCursorX*16);
-		int lastyBase = (LastCursorY*8)+(LastCursorY*16);
-		int lastAttribX = lastxBase >> 3;
-		int lastAttribY = lastyBase >> 3;
-
-		// clear last position and put the bits back.
-
-		if(LastCursorX != CursorX || LastCursorY != CursorY)
+		uchar col = (CursorX << 1) + CursorX;
+		uchar row = (CursorY << 1) + CursorY;
+		uchar attrib = m_AttribPlayerMap[m_CurrentPlayer] | BRIGHT;
+		uchar i;
+		uchar c, r;
+
+		// put the last position back.
+		if(m_CursorShown && (col != m_CursorCol || row != m_CursorRow))
 		{
-			// Left Bars
-			clga(lastxBase,lastyBase+8,8,16);
-			putsprite(spr_or,lastxBase,lastyBase+8,sprite0);
-			putsprite(spr_or,lastxBase,lastyBase+16,sprite0);
-
-			SetAttrib(lastAttribY + 1,lastAttribX,PAPER_BLUE | INK_WHITE | BRIGHT);
-			SetAttrib(lastAttribY + 2,lastAttribX,PAPER_BLUE | INK_WHITE | BRIGHT);
-
-
-
-			// Right Bars
-			clga(lastxBase+24,lastyBase+8,8,16);
-			putsprite(spr_or,lastxBase+24,lastyBase+8,sprite0);
-			putsprite(spr_or,lastxBase+24,lastyBase+16,sprite0);
-
-			SetAttrib(lastAttribY + 1,lastAttribX +3,PAPER_BLUE | INK_WHITE | BRIGHT);
-			SetAttrib(lastAttribY + 2,lastAttribX +3,PAPER_BLUE | INK_WHITE | BRIGHT);
-
-
-			// Top Bars
-			clga(lastxBase+8,lastyBase,16,8);
-			putsprite(spr_or,lastxBase+8,lastyBase,sprite1);
-			putsprite(spr_or,lastxBase+16,lastyBase,sprite1);
-			SetAttrib(lastAttribY,lastAttribX+1,PAPER_BLUE | INK_WHITE | BRIGHT);
-			SetAttrib(lastAttribY,lastAttribX+2,PAPER_BLUE | INK_WHITE | BRIGHT);
-
+			for(i = 0; i < 8; i++)
+			{
+				c = m_CursorCol + CursorPartX[i];
+				r = m_CursorRow + CursorPartY[i];
 
+				PutChar8(m_ScreenRows[r << 3] + c, m_CursorSavePixels + (i << 3));
+				m_AttribRows[r][c] = m_CursorSaveAttribs[i];
+				ShadowMark(c, r);
+			}
 
-			// bottom Bars
-			clga(lastxBase+8,lastyBase+24,16,8);
-			putsprite(spr_or,lastxBase+8,lastyBase+24,sprite1);
-			putsprite(spr_or,lastxBase+16,lastyBase+24,sprite1);
-			SetAttrib(lastAttribY+3,lastAttribX+1,PAPER_BLUE | INK_WHITE | BRIGHT);
-			SetAttrib(lastAttribY+3,lastAttribX+2,PAPER_BLUE | INK_WHITE | BRIGHT);
+			m_CursorShown = 0;
 		}
 
+		// save what's under the new position and draw the cursor over it.
+		if(!m_CursorShown)
+		{
+			for(i = 0; i < 8; i++)
+			{
+				c = col + CursorPartX[i];
+				r = row + CursorPartY[i];
 
+				GetChar8(m_CursorSavePixels + (i << 3), m_ScreenRows[r << 3] + c);
+				m_CursorSaveAttribs[i] = m_AttribRows[r][c];
+				PutChar8(m_ScreenRows[r << 3] + c, CursorImage + (i << 3));
+			}
 
-		// draw the cursor at the right place.
-
-
-		// Left Bars
-		clga(cursorXBase,cursorYBase+8,8,16);
-		putsprite(spr_or,cursorXBase,cursorYBase+8,sprite6);
-		putsprite(spr_or,cursorXBase,cursorYBase+16,sprite7);
-
-		SetAttrib(attribY + 1,attribX, m_AttribPlayerMap[m_CurrentPlayer] | BRIGHT);
-		SetAttrib(attribY + 2,attribX, m_AttribPlayerMap[m_CurrentPlayer] | BRIGHT);
-
-
-
-		// Right Bars
-		clga(cursorXBase+24,cursorYBase+8,8,16);
-		putsprite(spr_or,cursorXBase+24,cursorYBase+8,sprite4);
-		putsprite(spr_or,cursorXBase+24,cursorYBase+16,sprite5);
-
-		SetAttrib(attribY + 1,attribX +3, m_AttribPlayerMap[m_CurrentPlayer] | BRIGHT);
-		SetAttrib(attribY + 2,attribX +3, m_AttribPlayerMap[m_CurrentPlayer] | BRIGHT);
-
-
-		// Top Bars
-		clga(cursorXBase+8,cursorYBase,16,8);
-		putsprite(spr_or,cursorXBase+8,cursorYBase,sprite8);
-		putsprite(spr_or,cursorXBase+16,cursorYBase,sprite9);
-		SetAttrib(attribY,attribX+1, m_AttribPlayerMap[m_CurrentPlayer] | BRIGHT);
-		SetAttrib(attribY,attribX+2, m_AttribPlayerMap[m_CurrentPlayer] | BRIGHT);
-
-
-
-		// bottom Bars
-		clga(cursorXBase+8,cursorYBase+24,16,8);
-		putsprite(spr_or,cursorXBase+8,cursorYBase+24,sprite11);
-		putsprite(spr_or,cursorXBase+16,cursorYBase+24,sprite10);
-		SetAttrib(attribY+3,attribX+1, m_AttribPlayerMap[m_CurrentPlayer] | BRIGHT);
-		SetAttrib(attribY+3,attribX+2, m_AttribPlayerMap[m_CurrentPlayer] | BRIGHT);
-
-
-		// set all the attribs
+			m_CursorCol = col;
+			m_CursorRow = row;
+			m_CursorShown = 1;
+		}
 
+		// The cursor is the same shape for everyone, so the player colour is just the attributes.
+		for(i = 0; i < 8; i++)
+		{
+			m_AttribRows[row + CursorPartY[i]][col + CursorPartX[i]] = attrib;
+			ShadowMark(col + CursorPartX[i], row + CursorPartY[i]);
+		}
 
 		LastCursorX = CursorX;
 		LastCursorY = CursorY;
@@ -234,13 +270,15 @@ void SetupGame()
 	// Clear the Grid
 	int i = 0;
 
-	for(i=0; i < 70; i++)
-	{
-		m_PlayerGrid[i].Changed = 0;
-		m_PlayerGrid[i].GrowSize = 0;
-		m_PlayerGrid[i].Player = 0;
-		m_PlayerGrid[i].Size = 0;
-	}
+	memset(m_GridPlayer, 0, GRID_SQUARES);
+	memset(m_GridSize, 0, GRID_SQUARES);
+	memset(m_GridGrow, 0, GRID_SQUARES);
+	memset(m_GridChanged, 0, GRID_SQUARES);
+	memset(m_GridQueued, 0, GRID_SQUARES);
+
+	m_ActiveCount = 0;
+	m_EffectCount = 0;
+
 
 	// Reset the Player
 	// Player 0 is no player
@@ -249,10 +287,12 @@ void SetupGame()
 	m_GameFinished = 0;
 
 	m_TurnCount = 0;
+	m_PlayersLeft = 0;
+	m_GameDecided = 0;
 
 	for(i=0;i<5;i++)
 	{
-		m_Alive[i] = 0;
+		m_Owned[i] = 0;
 
 		if (m_CurrentPlayer == 0 && m_PlayerSetup[i] != 0)
 		{
@@ -260,569 +300,895 @@ void SetupGame()
 		}
 	}
 
+	m_Owned[0] = GRID_SQUARES;
 
 
 	CursorX = 0;
 	CursorY = 0;
 	LastCursorY = 0;
 	LastCursorX = 0;
+
+	// The screen has just been redrawn, so there's nothing to put back under the cursor
+	// and nothing on the board for the tile map to know about.
+	m_CursorShown = 0;
+	ResetTiles();
 }
 
 
-// Use the mask we defined above to remove the changed flag and the square state
-// with that we can just return it directly.
 uchar PlayerAtSquare(uchar x, uchar y)
 {
-	return m_PlayerGrid[(y * 10) + x].Player;
+	return m_GridPlayer[GridIndex(x, y)];
 }
 
-// Use the STATE mask to remove everything but the state and then move it 3 bits to the right so
-// it will return to being the same number it was before we pushed it into the bitmask
 uchar SizeAtSquare(uchar x, uchar y)
 {
-	return m_PlayerGrid[(y * 10) + x].Size;
+	return m_GridSize[GridIndex(x, y)];
 }
 
+// Copy the board out to dst, BOARD_SNAPSHOT_SIZE bytes.
+// One byte a square, the player in the top 4 bits and the size in the bottom 4.
+// Only good between turns, nothing that's part way through a chain reaction is kept.
+#define BOARD_SNAPSHOT_SIZE GRID_SQUARES
 
-void IncrementSquare(uchar x, uchar y, uchar player)
+void SnapshotBoard(uchar* dst)
 {
-	if (x > 9 || y > 6)
-	{
+	uchar i;
 
+	for (i = 0; i < GRID_SQUARES; i++)
+	{
+		dst[i] = (m_GridPlayer[i] << 4) | m_GridSize[i];
 	}
-
-	m_PlayerGrid[(y * 10) + x].GrowSize++;
-	m_PlayerGrid[(y * 10) + x].Changed = 1;
-	m_PlayerGrid[(y * 10) + x].Player = player;
 }
 
-
-// Wait for user input and do work based on it.
-// This is effectively a state as it won't finish till the user has placed an atom
-void PlayerInput()
+// Put back a board saved with SnapshotBoard and recount who owns what.
+// This is just the board, the screen isn't touched.
+void RestoreBoard(uchar* src)
 {
-	uchar moveOn = 1;
-	while(moveOn)
+	uchar i;
+
+	memset(m_GridGrow, 0, GRID_SQUARES);
+	memset(m_GridChanged, 0, GRID_SQUARES);
+	memset(m_GridQueued, 0, GRID_SQUARES);
+	memset(m_Owned, 0, 5);
+	m_ActiveCount = 0;
+	m_PlayersLeft = 0;
+
+	for (i = 0; i < GRID_SQUARES; i++)
+	{
+		m_GridPlayer[i] = src[i] >> 4;
+		m_GridSize[i] = src[i] & 15;
+		m_Owned[m_GridPlayer[i]]++;
+	}
+
+	for (i = 1; i < 5; i++)
 	{
-		int k = getk();
-		switch( k ) 
+		if (m_Owned[i])
 		{
-			case 11:
-			case 51:			
-			{
-				LastCursorX=CursorX;
-				LastCursorY=CursorY;
-				CursorY--;
-				bit_fx(0);
-				break;
-			}
+			m_PlayersLeft++;
+		}
+	}
 
-			case 10:
-			case 50:
-			{
-				LastCursorX=CursorX;
-				LastCursorY=CursorY;
-				CursorY++;
-				bit_fx(0);
-				break;
-			}
+	m_GameDecided = m_TurnCount && m_PlayersLeft == 1;
+}
 
-			break;
 
-			case 9:
-			case 52:
-			{
-				LastCursorX=CursorX;
-				LastCursorY=CursorY;
-				CursorX++;
-				bit_fx(0);
-				break;
-			}
+// Add a square to the active list, unless it's already on it.
+// The insert keeps the list sorted, if it lands in front of the square AnimateScreen is
+// working on then m_ActivePos is moved along so the scan carries on from the same square.
+void QueueSquare(uchar i)
+{
+	uchar pos;
 
+	if (m_GridQueued[i])
+	{
+		return;
+	}
 
-			case 8:
-			case 49:
-			{
-				LastCursorX=CursorX;
-				LastCursorY=CursorY;
-				CursorX--;
-				bit_fx(0);
-				break;
-			}
+	m_GridQueued[i] = 1;
 
-			case 32:
-			{
-				uchar player = PlayerAtSquare(CursorX,CursorY);
-				if(player == 0 || player == m_CurrentPlayer)
-				{
-					IncrementSquare(CursorX, CursorY,m_CurrentPlayer);
-					moveOn = 0;
-					//bit_fx(1);
-				}
-				break;
-			}
+	pos = m_ActiveCount;
+	while (pos && m_ActiveCells[pos - 1] > i)
+	{
+		m_ActiveCells[pos] = m_ActiveCells[pos - 1];
+		pos--;
+	}
 
-#ifdef DEBUG
-			// Helper to get some details out for debugging.
-			case 99:
-			{
-				int j=0;
-				printf("Turn: %d\n",m_TurnCount);
-				printf("current Player: %d\n",m_CurrentPlayer);
-				for(j=0;j<5;j++)
-				{
-					printf("Alive: %d = %d\n",j,m_Alive[j]);
-				}
+	m_ActiveCells[pos] = i;
+	m_ActiveCount++;
 
-				printf("GameFinished: %d\n",m_GameFinished);
+	if (pos <= m_ActivePos)
+	{
+		m_ActivePos++;
+	}
+}
 
-				printf("PlayerSetup: ");
-				for (j = 0; j < 5; j++)
-				{
-					printf("%d,", m_PlayerSetup[j]);
-				}
-				break;
-			}
-#endif
-		}
 
-		if(CursorX > 9)
-		{
-			CursorX = 9;
-		}
-		else if (CursorX < 0)
+// Set the attribute of the 4 characters of square i, straight onto the screen.
+void SetSquareAttrib(uchar i, uchar attrib)
+{
+	uchar* topology = TopologyOf(i);
+	uchar x = (GridToScreen(topology[TOPO_X]) + 8) >> 3;
+	uchar y = (GridToScreen(topology[TOPO_Y]) + 8) >> 3;
+	uchar* att = m_AttribRows[y] + x;
+
+	att[0] = attrib;
+	att[1] = attrib;
+	att[32] = attrib;
+	att[33] = attrib;
+	ShadowMarkArea(x, x + 1, y, y + 1);
+}
+
+// Start a colour cycle on square i, replacing any it already has.
+// If there are too many going already it's just not shown.
+void StartEffect(uchar i, uchar* cycle)
+{
+	uchar k;
+
+	for (k = 0; k < m_EffectCount; k++)
+	{
+		if (m_EffectCell[k] == i)
 		{
-			CursorX = 0;
+			m_EffectCycle[k] = cycle;
+			m_EffectStart[k] = m_FrameCount;
+			return;
 		}
+	}
+
+	if (m_EffectCount < MAX_EFFECTS)
+	{
+		m_EffectCell[m_EffectCount] = i;
+		m_EffectCycle[m_EffectCount] = cycle;
+		m_EffectStart[m_EffectCount] = m_FrameCount;
+		m_EffectCount++;
+	}
+}
+
+// Put every effect on the colour it's up to. The first colour goes on the frame after it was started,
+// and one more each frame after that, however many frames went by since this was last called.
+// A finished one marks its characters for the tile map to put back.
+void StepEffects()
+{
+	uchar k = 0;
+	uchar i;
+	uchar x;
+	uchar y;
+	uchar* topology;
+	uchar* cycle;
+	unsigned int now = m_FrameCount;
+	unsigned int frames;
+
+	while (k < m_EffectCount)
+	{
+		i = m_EffectCell[k];
 
-		if(CursorY > 6)
+		cycle = m_EffectCycle[k];
+		frames = now - m_EffectStart[k];
+		while (frames > 1 && *cycle != EFFECT_END)
 		{
-			CursorY = 6;
+			cycle++;
+			frames--;
 		}
-		else if (CursorY < 0)
+
+		if (*cycle != EFFECT_END)
 		{
-			CursorY = 0;
+			SetSquareAttrib(i, *cycle);
+			k++;
+			continue;
 		}
 
-		Halt();
-		DrawCursor(0);
+		topology = TopologyOf(i);
+		x = (GridToScreen(topology[TOPO_X]) + 8) >> 3;
+		y = (GridToScreen(topology[TOPO_Y]) + 8) >> 3;
+		MarkTile(((unsigned int)y << 5) + x);
+		MarkTile(((unsigned int)y << 5) + x + 1);
+		MarkTile(((unsigned int)(y + 1) << 5) + x);
+		MarkTile(((unsigned int)(y + 1) << 5) + x + 1);
+
+		// Swap the last one in to fill the gap, the order doesn't matter.
+		m_EffectCount--;
+		m_EffectCell[k] = m_EffectCell[m_EffectCount];
+		m_EffectCycle[k] = m_EffectCycle[m_EffectCount];
+		m_EffectStart[k] = m_EffectStart[m_EffectCount];
 	}
 }
 
-
-void DrawSquare(uchar x, uchar y, uchar size, uchar player, uchar bright)
+// Add an atom to the square at index i and hand the square to player.
+void IncrementCell(uchar i, uchar player)
 {
-	if (size)
+	uchar last = m_GridPlayer[i];
+
+	if (last != player)
 	{
-		uchar attrib = m_AttribPlayerMap[player];
-		x = (x * 8) + (x * 16) + 8;
-		y = (y * 8) + (y * 16) + 8;
+		if (m_Owned[player]++ == 0)
+		{
+			m_PlayersLeft++;
+		}
 
-		if (bright)
+		if (--m_Owned[last] == 0 && last)
 		{
-			attrib = attrib | BRIGHT;
+			m_PlayersLeft--;
 		}
 
-		attrib = attrib | BRIGHT;
+		if (last)
+		{
+			StartEffect(i, m_CaptureCycle[player]);
 
-		clga(x, y, 16, 16);
+			// That was someone else's square, if it was the last one anybody but player had the game is over.
+			if (m_PlayersLeft == 1 && m_TurnCount)
+			{
+				m_GameDecided = 1;
+			}
+		}
+	}
 
-		putsprite(SPR_OR, x, y, m_Atoms[size - 1]);
+	m_GridGrow[i]++;
+	m_GridChanged[i] = 1;
+	m_GridPlayer[i] = player;
 
-		// fun fact, doing ">> 3" is the same as "/ 8" but the Z80 can do ">> 3" easily where division are Sloooow
-		SetAttribArea(x >> 3, (x >> 3) + 1, y >> 3, (y >> 3) + 1, attrib);
-	}
+	QueueSquare(i);
 }
 
-void AnimateScreen()
-{	
-	uchar animating = 1;
-	int x=0;
-	int y=0;
-	uchar j;
-	uchar allSame = 1;
-	char lastPlayer = -1;
-	char exploded = 0;
-	char done = 0;
-	char grow = 0;
 
-	while (animating)
+void IncrementSquare(uchar x, uchar y, uchar player)
+{
+	if (x > 9 || y > 6)
 	{
-		Halt();
 
-		lastPlayer = -1;
-		allSame = 1;
-		exploded = 0;
-		grow = 0;
-		done = 1;
-		for (j = 0; j < 70;j++)
-		{
-			if (m_PlayerGrid[j].GrowSize && m_PlayerGrid[j].Size != 5)
-			{
-				m_PlayerGrid[j].Changed = 1;
-				if (m_PlayerGrid[j].GrowSize)
-				{
-					done = 0;
-				}
+	}
 
-				m_PlayerGrid[j].Size += m_PlayerGrid[j].GrowSize;
-				if (m_PlayerGrid[j].Size > m_PlayerGrid[j].MaxSize)
-				{
-					m_PlayerGrid[j].GrowSize = m_PlayerGrid[j].Size - m_PlayerGrid[j].MaxSize;
-					m_PlayerGrid[j].Size = m_PlayerGrid[j].MaxSize;
-				}
-				else
-				{
-					m_PlayerGrid[j].GrowSize = 0;
-				}
-			}
-		}
+	IncrementCell(GridIndex(x, y), player);
+}
+
+
+// A frame of waiting for the player, moves the cursor about and returns 0 once they've placed an atom.
+uchar InputStep()
+{
+	uchar moveOn = 1;
+	int k;
 
-		for(j=0;j<5;j++)
+	DrawCursor(0);
+
+	// Joystick players only listen to their stick, the keyboard is someone else's
+	// (and a Sinclair stick's number keys are kept out of the key queue, see UseJoysticks).
+	if (m_PlayerInput[m_CurrentPlayer] != INPUT_KEYS)
+	{
+		k = ReadJoystick(m_PlayerInput[m_CurrentPlayer]);
+	}
+	else
+	{
+		k = ReadKey();
+	}
+
+	switch( k ) 
+	{
+		case 11:
+		case 51:			
 		{
-			m_Alive[j] = 0;
+			LastCursorX=CursorX;
+			LastCursorY=CursorY;
+			CursorY--;
+			PlaySound(m_SoundMove);
+			break;
 		}
 
-		for(y = 0; y < 7; y++)
+		case 10:
+		case 50:
 		{
-			for(x = 0; x < 10; x++)
-			{
-				int i  = (y*10) + x;
+			LastCursorX=CursorX;
+			LastCursorY=CursorY;
+			CursorY++;
+			PlaySound(m_SoundMove);
+			break;
+		}
 
-				uchar size = m_PlayerGrid[i].Size;
-				uchar player = m_PlayerGrid[i].Player;
-				
-				if(lastPlayer == -1 && player != 0)
-				{
-					lastPlayer = player;
-				}
-				else if(lastPlayer != player && player != 0)
-				{
-					allSame = 0;
-				}
+		break;
 
-				m_Alive[player]++;
-				
-				if(m_PlayerGrid[i].Changed)
-				{
-					animating = 2;
-
-					if(size == m_PlayerGrid[i].MaxSize)
-					{
-						DrawSquare(x,y,4, player,1);
-						m_PlayerGrid[i].Changed = 1;
-						m_PlayerGrid[i].Size = 5;
-						exploded=1;
-					}
-					else if (size == 5)
-					{						
-						uchar attribX = (GridToScreen(x) + 8) >> 3;
-						uchar attribY = (GridToScreen(y) + 8) >> 3;
-
-						m_PlayerGrid[i].Size = 0;
-						m_PlayerGrid[i].Player = 0;
-						m_PlayerGrid[i].Changed = 0;
-						// Clear it and just set the Changed flag
-
-						// Clear the square, don't bother clearing the pixels, lets just hide it :)
-						SetAttribArea(attribX,attribX+1,attribY,attribY+1,m_AttribPlayerMap[0]);
-
-						// Do explosion logic!
-
-						if(y == 0 && x == 0)
-						{
-							IncrementSquare(x+1,y,player);
-							IncrementSquare(x,y+1,player);
-						}
-						else if(y == 0 && x == 9)
-						{
-							IncrementSquare(x-1,y,player);
-							IncrementSquare(x,y+1,player);
-						}
-						else if(y == 0)
-						{
-							IncrementSquare(x+1,y,player);
-							IncrementSquare(x-1, y,player);
-							IncrementSquare(x,y+1,player);
-						}
-						else if(y == 6 && x == 0)
-						{
-							IncrementSquare(x+1,y,player);
-							IncrementSquare(x,y-1,player);
-						}
-						else if (x == 0)
-						{
-							IncrementSquare(x+1,y,player);
-							IncrementSquare(x, y-1,player);
-							IncrementSquare(x,y+1,player);
-						}
-						else if(y == 6 && x == 9)
-						{
-							IncrementSquare(x-1,y,player);
-							IncrementSquare(x,y-1,player);
-						}
-						else if(y == 6)
-						{
-							IncrementSquare(x+1,y,player);
-							IncrementSquare(x-1, y,player);
-							IncrementSquare(x,y-1,player);
-						}
-						else if(x == 9)
-						{
-							IncrementSquare(x-1,y,player);
-							IncrementSquare(x, y-1,player);
-							IncrementSquare(x,y+1,player);
-						}
-						 else
-						{
-							IncrementSquare(x+1,y,player);
-							IncrementSquare(x, y-1,player);
-							IncrementSquare(x,y+1,player);
-							IncrementSquare(x-1,y,player);
-						}
-					}
-					else
-					{
-						if (size)
-						{
-							DrawSquare(x, y, size, player, 0);
-							m_PlayerGrid[i].Player = player;
-							m_PlayerGrid[i].Changed = 0;
-							grow = 1;
-						}
-					}
-				}
-			}
-		}	
-		if(done)
+		case 9:
+		case 52:
 		{
-			animating--;
+			LastCursorX=CursorX;
+			LastCursorY=CursorY;
+			CursorX++;
+			PlaySound(m_SoundMove);
+			break;
 		}
 
-		if(exploded)
-		{
-			bit_fx2(2);
-		}
-		else if (grow)
+
+		case 8:
+		case 49:
 		{
-			bit_fx(1);
+			LastCursorX=CursorX;
+			LastCursorY=CursorY;
+			CursorX--;
+			PlaySound(m_SoundMove);
+			break;
 		}
 
-		// Allow for early out!
-		if(allSame && m_TurnCount)
+		case 32:
 		{
-			m_GameFinished = 1;
-			animating = 0;
+			uchar player = PlayerAtSquare(CursorX,CursorY);
+			if(player == 0 || player == m_CurrentPlayer)
+			{
+				IncrementSquare(CursorX, CursorY,m_CurrentPlayer);
+				moveOn = 0;
+
+				// Anything still queued was pressed during this go (a second space, cursor keys
+				// past the one that was placed), so it goes with it.
+				// Presses from here on, during the chain reaction or the computer's go, are kept
+				// for the next player.
+				FlushKeys();
+				//PlaySound(m_SoundGrow);
+			}
+			break;
 		}
 
-		if (getk() == 99)
+#ifdef DEBUG
+		// Helper to get some details out for debugging.
+		case 99:
 		{
-			printf("Turn: %d\n", m_TurnCount);
-			printf("current Player: %d\n", m_CurrentPlayer);
+			int j=0;
+			printf("Turn: %d\n",m_TurnCount);
+			printf("current Player: %d\n",m_CurrentPlayer);
+			for(j=0;j<5;j++)
+			{
+				printf("Owned: %d = %d\n",j,m_Owned[j]);
+			}
 
-			printf("GameFinished: %d\n", m_GameFinished);
-			printf("allSame: %d\n", allSame);
-			printf("animating: %d\n", animating);
-			printf("done: %d\n", done);
+			printf("GameFinished: %d\n",m_GameFinished);
 
-			while (1)
+			printf("PlayerSetup: ");
+			for (j = 0; j < 5; j++)
 			{
-
+				printf("%d,", m_PlayerSetup[j]);
 			}
+			break;
 		}
+#endif
+	}
+
+	if(CursorX > 9)
+	{
+		CursorX = 9;
+	}
+	else if (CursorX < 0)
+	{
+		CursorX = 0;
+	}
 
+	if(CursorY > 6)
+	{
+		CursorY = 6;
+	}
+	else if (CursorY < 0)
+	{
+		CursorY = 0;
 	}
+
+	return moveOn;
+}
+
+// Wait for user input and do work based on it.
+// This is effectively a state as it won't finish till the user has placed an atom
+void PlayerInput()
+{
+	RunPhase(InputStep, 1);
 }
 
 
-// Changes player and does a check to see if a player has won.
-void CheckForFinished()
+// The atoms cut up into 8x8 tiles for the tile map, tile 0 is blank and then 4 tiles
+// (top left, top right, bottom left, bottom right) for each size. Filled in by BuildAtomTiles.
+uchar m_AtomTiles[136];
+
+void BuildAtomTiles()
 {
-	uchar startingPlayer = m_CurrentPlayer;
-	while (1)
+	uchar size, quarter, line;
+	uchar* tile = m_AtomTiles;
+	uchar* sprite;
+
+	memset(m_AtomTiles, 0, 8);
+	tile += 8;
+
+	for (size = 0; size < 4; size++)
 	{
-		m_CurrentPlayer++;
-		
-		if(m_CurrentPlayer > 4)
+		for (quarter = 0; quarter < 4; quarter++)
 		{
-			m_CurrentPlayer = 1;
-			m_TurnCount++;
-		}
+			// skip the width and height, then move to the right half and / or the bottom half.
+			sprite = m_Atoms[size] + 2 + (quarter & 1) + ((quarter & 2) << 3);
 
-		if(m_TurnCount)
-		{
-			if(m_CurrentPlayer == startingPlayer)
-			{
-				m_GameFinished = 1;
-				break;
-			}
-			else if(m_Alive[m_CurrentPlayer] && m_PlayerSetup[m_CurrentPlayer] != 0)
-			{
-				break;
-			}
-		}
-		else
-		{
-			if (m_PlayerSetup[m_CurrentPlayer] != 0)
+			for (line = 0; line < 8; line++)
 			{
-				break;
+				*tile++ = *sprite;
+				sprite += 2;
 			}
 		}
-	}	
+	}
 }
 
-
-// Show the winner screen
-void Winner()
+// Put an atom on the tile map, it won't be seen until the next FlushTiles.
+// flash sets the FLASH bit, which is used for squares that are one atom off exploding.
+void DrawSquare(uchar x, uchar y, uchar size, uchar player, uchar flash)
 {
-	uchar i = 0;
-	uchar attrib = PAPER_MAGENTA | INK_BLACK;
-	clg();
-	getk();
+	if (size)
+	{
+		uchar attrib = m_AttribPlayerMap[player] | BRIGHT;
+		uchar tile = ((size - 1) << 2) + 1;
+		x = (x * 8) + (x * 16) + 8;
+		y = (y * 8) + (y * 16) + 8;
 
-	Halt();
-	DrawScrWithAttribs(WinnerScr);
+		if (flash)
+		{
+			attrib = attrib | FLASH;
+		}
 
+		// fun fact, doing ">> 3" is the same as "/ 8" but the Z80 can do ">> 3" easily where division are Sloooow
+		x = x >> 3;
+		y = y >> 3;
 
-	switch (m_CurrentPlayer)
-	{
-		case 1:
-			attrib = PAPER_MAGENTA | INK_BLACK;
-			break;
+		SetTile(x, y, tile, attrib);
+		SetTile(x + 1, y, tile + 1, attrib);
+		SetTile(x, y + 1, tile + 2, attrib);
+		SetTile(x + 1, y + 1, tile + 3, attrib);
+	}
+}
 
-		case 2:
-			attrib = PAPER_RED | INK_BLACK;
-			break;
+// Hide a square, don't bother clearing the pixels, lets just hide it with the attributes :)
+void HideSquare(uchar x, uchar y)
+{
+	uchar attrib = m_AttribPlayerMap[0];
+	x = (GridToScreen(x) + 8) >> 3;
+	y = (GridToScreen(y) + 8) >> 3;
+
+	SetTileAttrib(x, y, attrib);
+	SetTileAttrib(x + 1, y, attrib);
+	SetTileAttrib(x, y + 1, attrib);
+	SetTileAttrib(x + 1, y + 1, attrib);
+}
 
-		case 3:
-			attrib = PAPER_GREEN | INK_BLACK;
-			break;
+// Ask for a square to be drawn on the next flush, a size of 0 hides it.
+// If it's already waiting it just takes on the new look, the tile map only keeps the latest one.
+void QueueRender(uchar i, uchar size, uchar player)
+{
+	uchar* topology = TopologyOf(i);
 
-		case 4:
-			attrib = PAPER_YELLOW | INK_BLACK;
-			break;
-	default:
-		break;
+	if (size)
+	{
+		DrawSquare(topology[TOPO_X], topology[TOPO_Y], size, player, size == topology[TOPO_MAX] - 1);
 	}
+	else
+	{
+		HideSquare(topology[TOPO_X], topology[TOPO_Y]);
+	}
+}
 
-	attrib = attrib | BRIGHT;
-
-	SetAttribArea(3, 28, 1, 6, attrib);
-	SetAttrib(5, 2, attrib);	
-	SetAttribArea(4, 5, 6, 6, PAPER_BLUE | INK_BLACK | BRIGHT);
-	SetAttribArea(12, 13, 1, 1, PAPER_BLUE | INK_BLACK | BRIGHT);
-	SetAttrib(1, 17, PAPER_BLUE | INK_BLACK | BRIGHT);
-	SetAttrib(6, 10, PAPER_BLUE | INK_BLACK | BRIGHT);
-	SetAttrib(6, 12, PAPER_BLUE | INK_BLACK | BRIGHT);
-	SetAttrib(6, 17, PAPER_BLUE | INK_BLACK | BRIGHT);
-
-	
-	SetAttribArea(7, 7, 13, 15, attrib);
-	SetAttribArea(8, 8, 13, 17, attrib);
-	SetAttribArea(9, 9, 13, 18, attrib);
-	SetAttribArea(10, 10, 13, 19, attrib);
-	SetAttribArea(11, 11, 14, 20, attrib);
-	SetAttribArea(11, 11, 22, 23, attrib);
-	SetAttribArea(12, 12, 18, 23, attrib);
-	SetAttribArea(13, 13, 19, 23, attrib);
-	SetAttribArea(14, 16, 20, 23, attrib);
-	SetAttribArea(17, 17, 19, 23, attrib);
-	SetAttribArea(18, 18, 18, 23, attrib);
-	SetAttribArea(19, 19, 15, 23, attrib);
-	SetAttribArea(20, 20, 13, 20, attrib);
-	SetAttribArea(21, 21, 13, 18, attrib);
-	SetAttribArea(22, 22, 13, 16, attrib);
-	SetAttribArea(23, 23, 13, 14, attrib);
+uchar m_RenderSkipped = 0;
 
-	
-	for (i = 0; i < 100; i++)
+// Write out the changed characters, from the top of the screen down.
+// Call it straight after Halt(), anything that doesn't fit in RENDER_BUDGET waits for the next frame.
+// If the last step ran over the drawing is left for a frame so the game can catch up,
+// but never two frames running or nothing would ever get drawn on the fast speeds.
+void FlushRender()
+{
+	if (m_FrameLate && !m_RenderSkipped)
 	{
-		getk();
-		Halt();
+		m_RenderSkipped = 1;
 	}
+	else
+	{
+		m_RenderSkipped = 0;
+		FlushTiles(RENDER_BUDGET);
+	}
+	StepEffects();
+}
 
-	while (1)
+// Copy (or compare) the state of a chain reaction, everything that decides what the next generation does.
+void SaveCascadeState()
+{
+	memcpy(m_CycleState, m_GridPlayer, GRID_SQUARES);
+	memcpy(m_CycleState + GRID_SQUARES, m_GridSize, GRID_SQUARES);
+	memcpy(m_CycleState + (GRID_SQUARES * 2), m_GridGrow, GRID_SQUARES);
+	memcpy(m_CycleState + (GRID_SQUARES * 3), m_GridChanged, GRID_SQUARES);
+}
+
+uchar SameCascadeState()
+{
+	return !memcmp(m_CycleState, m_GridPlayer, GRID_SQUARES)
+		&& !memcmp(m_CycleState + GRID_SQUARES, m_GridSize, GRID_SQUARES)
+		&& !memcmp(m_CycleState + (GRID_SQUARES * 2), m_GridGrow, GRID_SQUARES)
+		&& !memcmp(m_CycleState + (GRID_SQUARES * 3), m_GridChanged, GRID_SQUARES);
+}
+
+// Stop a chain reaction where it is. Any atoms still on their way are added on,
+// and squares that would go off are left one short of it so the board is back to
+// normal (nothing else ever sits full between turns, the AI included).
+// Atom totals aren't kept: what doesn't fit is dropped, and so are the atoms taken off squares that
+// were about to go off. It only runs when MAX_GENERATIONS or the loop check stops a chain reaction,
+// which a normal game never gets to, so a playable board matters more than the count.
+void SettleBoard()
+{
+	uchar k;
+	uchar i;
+	uchar max;
+
+	for (k = 0; k < m_ActiveCount; k++)
 	{
-		if (getk() != 0)
+		i = m_ActiveCells[k];
+		max = TopologyOf(i)[TOPO_MAX] - 1;
+
+		if (m_GridSize[i] == 5)
 		{
-			bit_fx4(7);
-			break;
+			m_GridSize[i] = max;
 		}
+
+		m_GridSize[i] += m_GridGrow[i];
+		if (m_GridSize[i] > max)
+		{
+			m_GridSize[i] = max;
+		}
+
+		m_GridGrow[i] = 0;
+		m_GridChanged[i] = 0;
+		m_GridQueued[i] = 0;
+		QueueRender(i, m_GridSize[i], m_GridPlayer[i]);
 	}
+
+	m_ActiveCount = 0;
 }
 
+// State of the chain reaction between steps.
+uchar m_CascadeAnimating;
+char m_CascadeExploded;
+char m_CascadeGrow;
 
-// Setup the game tables that won't change.
-// Could be setup manually and stored but that's more work.
-void SetupDefaults()
+// One generation of the chain reaction.
+// Only the squares on the active list are looked at, squares that aren't growing,
+// waiting to explode or needing a redraw can't change so there is no point scanning them.
+void CascadeGeneration()
 {
-	int x = 0;
-	int y = 0;
-	int i = 0;
+	uchar i;
+	uchar j;
+	uchar max;
+	uchar* topology;
+	char done = 1;
 
-	m_Atoms[0] = sprite3;
-	m_Atoms[1] = sprite13;
-	m_Atoms[2] = sprite12;
-	m_Atoms[3] = sprite14;
+	// Grow any squares that have atoms waiting, and drop squares that have nothing left to do.
+	j = 0;
+	for (m_ActivePos = 0; m_ActivePos < m_ActiveCount; m_ActivePos++)
+	{
+		i = m_ActiveCells[m_ActivePos];
 
-	m_AttribPlayerMap[0] = PAPER_BLUE | INK_BLUE | BRIGHT;
-	m_AttribPlayerMap[1] = PAPER_BLUE | INK_MAGENTA | BRIGHT;
-	m_AttribPlayerMap[2] = PAPER_BLUE | INK_RED | BRIGHT;
-	m_AttribPlayerMap[3] = PAPER_BLUE | INK_GREEN | BRIGHT;
-	m_AttribPlayerMap[4] = PAPER_BLUE | INK_YELLOW | BRIGHT;
+		if (m_GridGrow[i] && m_GridSize[i] != 5)
+		{
+			m_GridChanged[i] = 1;
+			done = 0;
 
-	for (i = 0; i < 5; i++)
-	{
-		m_PlayerSetup[i] = 0;
+			m_GridSize[i] += m_GridGrow[i];
+			max = TopologyOf(i)[TOPO_MAX];
+			if (m_GridSize[i] > max)
+			{
+				m_GridGrow[i] = m_GridSize[i] - max;
+				m_GridSize[i] = max;
+			}
+			else
+			{
+				m_GridGrow[i] = 0;
+			}
+		}
+
+		if (m_GridChanged[i] || m_GridGrow[i])
+		{
+			m_ActiveCells[j++] = i;
+		}
+		else
+		{
+			m_GridQueued[i] = 0;
+		}
 	}
+	m_ActiveCount = j;
 
-	i = 0;
-	for(y=0;y<7;y++)
+	for (m_ActivePos = 0; m_ActivePos < m_ActiveCount && !m_GameDecided; m_ActivePos++)
 	{
-		for(x = 0;x<10;x++)
+		uchar size;
+		uchar player;
+
+		i = m_ActiveCells[m_ActivePos];
+		if (!m_GridChanged[i])
 		{
+			continue;
+		}
 
+		topology = TopologyOf(i);
 
+		size = m_GridSize[i];
+		player = m_GridPlayer[i];
 
-			if(y == 0 && x == 0)
-			{				
-				m_PlayerGrid[i].MaxSize = 2;
-			}
-			else if(y == 0 && x == 9)
-			{
-				m_PlayerGrid[i].MaxSize = 2;
-			}
-			else if(y == 0)
+		m_CascadeAnimating = 2;
+
+		if(size == topology[TOPO_MAX])
+		{
+			// Going off, the square stays as it is and the explosion is all done with the attributes.
+			StartEffect(i, m_ExplodeCycle);
+			m_GridChanged[i] = 1;
+			m_GridSize[i] = 5;
+			m_CascadeExploded=1;
+		}
+		else if (size == 5)
+		{						
+			m_GridSize[i] = 0;
+			m_GridPlayer[i] = 0;
+			m_GridChanged[i] = 0;
+			// If this was player's last square the atoms going out below give them some back straight away.
+			if (--m_Owned[player] == 0)
 			{
-				m_PlayerGrid[i].MaxSize = 3;
+				m_PlayersLeft--;
 			}
-			else if(y == 6 && x == 0)
+			m_Owned[0]++;
+			// Clear it and just set the Changed flag
+
+			// Clear the square, don't bother clearing the pixels, lets just hide it :)
+			QueueRender(i, 0, 0);
+
+			// Do explosion logic!
+			// One atom goes to each neighbour, the table already knows who they are.
+			for (j = topology[TOPO_COUNT]; j; j--)
 			{
-				m_PlayerGrid[i].MaxSize = 2;
+				IncrementCell(topology[TOPO_LINKS + j - 1], player);
 			}
-			else if (x == 0)
+		}
+		else
+		{
+			if (size)
 			{
-				m_PlayerGrid[i].MaxSize = 3;
+				QueueRender(i, size, player);
+				m_GridChanged[i] = 0;
+				m_CascadeGrow = 1;
 			}
-			else if(y == 6 && x == 9)
+		}
+	}
+	if(done)
+	{
+		m_CascadeAnimating--;
+	}
+
+	// Allow for early out! There's no point playing out the rest of the chain once the game is won.
+	if(m_GameDecided)
+	{
+		m_GameFinished = 1;
+		m_CascadeAnimating = 0;
+	}
+
+	m_Generations++;
+
+	if (m_CascadeAnimating && m_Generations >= CYCLE_CHECK_FROM)
+	{
+		if (m_Generations >= MAX_GENERATIONS || (m_Generations != CYCLE_CHECK_FROM && SameCascadeState()))
+		{
+			SettleBoard();
+			m_CascadeAnimating = 0;
+		}
+		else if (m_Generations == m_CycleSaveAt)
+		{
+			SaveCascadeState();
+			m_CycleSaveAt <<= 1;
+		}
+	}
+
+#ifdef DEBUG
+	// Helper to get some details out for debugging, stops everything so they can be read.
+	if (PeekKey() == 99)
+	{
+		printf("Turn: %d\n", m_TurnCount);
+		printf("current Player: %d\n", m_CurrentPlayer);
+
+		printf("GameFinished: %d\n", m_GameFinished);
+		printf("decided: %d\n", m_GameDecided);
+		printf("animating: %d\n", m_CascadeAnimating);
+		printf("done: %d\n", done);
+		printf("generations: %d\n", m_Generations);
+		printf("frames dropped: %u\n", m_FramesDropped);
+
+		while (1)
+		{
+
+		}
+	}
+#endif
+}
+
+// A frame of the chain reaction. Draw what changed last time round straight after the interrupt,
+// before the beam gets to it, then run the next generation.
+// On the faster speeds a few generations are run before the next frame is shown.
+uchar CascadeStep()
+{
+	uchar batch = m_AnimSpeeds[m_AnimSpeedSetting];
+
+	FlushRender();
+
+	m_CascadeExploded = 0;
+	m_CascadeGrow = 0;
+
+	while (batch && m_CascadeAnimating)
+	{
+		CascadeGeneration();
+		batch--;
+	}
+
+	// One sound per frame shown, not per generation, and none if the last one is still waiting to play.
+	if(m_CascadeExploded)
+	{
+		PlaySoundIfQuiet(m_SoundExplode);
+	}
+	else if (m_CascadeGrow)
+	{
+		PlaySoundIfQuiet(m_SoundGrow);
+	}
+
+	return m_CascadeAnimating;
+}
+
+// Finish drawing anything that didn't fit in the last frame, and let the effects play out.
+uchar DrainStep()
+{
+	FlushRender();
+	return m_TileDirtyCount || m_EffectCount;
+}
+
+// Runs the chain reactions, a frame at a time.
+void AnimateScreen()
+{	
+	m_Generations = 0;
+	m_CycleSaveAt = CYCLE_CHECK_FROM;
+	m_CascadeAnimating = 1;
+
+	RunPhase(CascadeStep, 1);
+
+	if (m_TileDirtyCount || m_EffectCount)
+	{
+		RunPhase(DrainStep, 1);
+	}
+}
+
+
+// Changes player and does a check to see if a player has won.
+void CheckForFinished()
+{
+	uchar startingPlayer = m_CurrentPlayer;
+	while (1)
+	{
+		m_CurrentPlayer++;
+		
+		if(m_CurrentPlayer > 4)
+		{
+			m_CurrentPlayer = 1;
+			m_TurnCount++;
+		}
+
+		if(m_TurnCount)
+		{
+			if(m_CurrentPlayer == startingPlayer)
 			{
-				m_PlayerGrid[i].MaxSize = 2;
+				m_GameFinished = 1;
+				break;
 			}
-			else if(y == 6)
+			else if(m_Owned[m_CurrentPlayer] && m_PlayerSetup[m_CurrentPlayer] != 0)
 			{
-				m_PlayerGrid[i].MaxSize = 3;
+				break;
 			}
-			else if(x == 9)
+		}
+		else
+		{
+			if (m_PlayerSetup[m_CurrentPlayer] != 0)
 			{
-				m_PlayerGrid[i].MaxSize = 3;
+				break;
 			}
-			else
+		}
+	}	
+}
+
+
+// Frames left before the winner screen will take a key, so it isn't skipped by accident.
+#define WINNER_WAIT 100
+uchar m_WinnerWait;
+
+uchar WinnerStep()
+{
+	if (m_WinnerWait)
+	{
+		// The first frame puts the colours on, the picture underneath is still black on black till then.
+		// Unpacking runs over a frame, so hold off till a frame that was waited for or the copy won't beat the beam.
+		if (m_WinnerWait == WINNER_WAIT)
+		{
+			if (m_FrameLate)
 			{
-				m_PlayerGrid[i].MaxSize = 4;
+				return 1;
 			}
 
-			i++;
+			CopyAttribRows(m_AttribBuffer, 0, 24);
 		}
+
+		// Keys pressed while it was held off are dropped, once, so they can't skip the screen.
+		if (--m_WinnerWait == 0)
+		{
+			FlushKeys();
+		}
+		return 1;
+	}
+
+	if (ReadKey() != 0)
+	{
+		PlaySoundNow(m_SoundStart);
+		return 0;
+	}
+
+	return 1;
+}
+
+// Show the winner screen
+void Winner()
+{
+	uchar palette[3];
+	FlushKeys();
+
+	UnpackScr(WinnerScrPixels, WinnerScrAttribs);
+
+	// The trophy goes the colour of the winner, their ink colour makes the paper.
+	// Painted on before the attributes go on the screen so it's right from the first frame.
+	palette[1] = ((m_AttribPlayerMap[m_CurrentPlayer] & 7) << 3) | INK_BLACK | BRIGHT;
+	palette[2] = PAPER_BLUE | INK_BLACK | BRIGHT;
+	ApplyAttribMaskTo(m_AttribBuffer, WinnerAttribs, 2, 1, palette);
+
+	m_WinnerWait = WINNER_WAIT;
+	RunPhase(WinnerStep, 1);
+}
+
+
+// Setup the game tables that won't change.
+// Could be setup manually and stored but that's more work.
+void SetupDefaults()
+{
+	int i = 0;
+
+	SetupFrameInterrupt();
+	SetupScreenTables();
+	m_HasAY = HasAY();
+
+#ifdef DOUBLE_BUFFER
+	// Only double buffer if there's a shadow screen to use, and start it off with a full copy.
+	// If the stack is up where bank 7 goes it can't page it in, so it draws straight to the screen like a 48K.
+	m_DoubleBuffer = ShadowStackFits() && Has128KPaging();
+	m_ShadowAll = 1;
+#endif
+
+	m_Atoms[0] = sprite3;
+	m_Atoms[1] = sprite13;
+	m_Atoms[2] = sprite12;
+	m_Atoms[3] = sprite14;
+
+	BuildAtomTiles();
+	m_TileBank = m_AtomTiles;
+
+	m_AttribPlayerMap[0] = PAPER_BLUE | INK_BLUE | BRIGHT;
+	m_AttribPlayerMap[1] = PAPER_BLUE | INK_MAGENTA | BRIGHT;
+	m_AttribPlayerMap[2] = PAPER_BLUE | INK_RED | BRIGHT;
+	m_AttribPlayerMap[3] = PAPER_BLUE | INK_GREEN | BRIGHT;
+	m_AttribPlayerMap[4] = PAPER_BLUE | INK_YELLOW | BRIGHT;
+
+	// A square changing hands flashes white, then shows the new owner's colour as a solid block for a bit.
+	for (i = 0; i < 5; i++)
+	{
+		uchar ink = m_AttribPlayerMap[i] & 7;
+		uchar solid = ink | (ink << 3) | BRIGHT;
+
+		m_CaptureCycle[i][0] = PAPER_WHITE | INK_WHITE | BRIGHT;
+		m_CaptureCycle[i][1] = solid;
+		m_CaptureCycle[i][2] = solid;
+		m_CaptureCycle[i][3] = solid;
+		m_CaptureCycle[i][4] = EFFECT_END;
+	}
+
+	for (i = 0; i < 5; i++)
+	{
+		m_PlayerSetup[i] = 0;
+		m_PlayerInput[i] = INPUT_KEYS;
 	}
 }
 
@@ -833,18 +1199,16 @@ void DrawAllSizes()
 	uchar x,y;
 	uchar defaultAttrib = PAPER_BLUE | INK_WHITE;
 	Halt();
-	
-	SetAttribArea(0,32,0,24, defaultAttrib);		
-	clg();
+	ClearScreen(defaultAttrib);
 
 	DrawGrid();
+	ResetTiles();
 
-	Halt();
 	for(y = 0; y < 7; y++)
 	{
 		for(x = 0; x < 10; x++)
 		{
-			DrawSquare(x,y,m_PlayerGrid[(y*10) + x].MaxSize,player++,0);
+			DrawSquare(x,y,TopologyOf(GridIndex(x, y))[TOPO_MAX],player++,0);
 
 			if(player > 4)
 			{
@@ -857,83 +1221,361 @@ void DrawAllSizes()
 	while (1)
 	{
 		Halt();
+		FlushRender();
 	}
 }
 
-void AIInput()
+// The computer player.
+// Every square it's allowed to go on is tried out on the board itself with the chain reaction worked
+// out straight away, nothing drawn, then the board that comes out is scored by AIScore and put back
+// from the SnapshotBoard taken before it started.
+// It's run as a phase so it takes a few frames, and after AI_FRAME_BUDGET frames it goes with the best so far.
+#define AI_FRAME_BUDGET 50
+#define AI_MAX_EXPLOSIONS 250	// A chain reaction this long has taken the board, no need to see the end of it
+#define AI_WIN 30000
+
+uchar m_AIRoot[BOARD_SNAPSHOT_SIZE];	// The board as it was before the computer started trying moves
+uchar m_SimStack[GRID_SQUARES];		// Squares waiting to go off, a square can only be on it once
+uchar m_SimEnemies;			// Squares the other players have left
+uchar m_SimWon;
+
+uchar m_AINext;				// The next square to try
+uchar m_AILeft;				// How many squares are still to try
+uchar m_AIBest;				// 255 till a move has been found
+int m_AIBestScore;
+unsigned int m_AIStartFrame;
+
+// Add an atom to a square, returns 1 if that's just made it go critical.
+uchar SimAdd(uchar i, uchar player)
 {
-	uchar attempt = 5;
-	uchar done = 0;
-	uchar rndx, rndy, player;
-
-	while (attempt > 0 && done == 0)
-	{		
-		do
+	if (m_GridPlayer[i] != player)
+	{
+		if (m_GridPlayer[i])
 		{
-			rndx = rand();
-			rndx = (rndx & 0xF);
-		} while (rndx > 9);
+			m_SimEnemies--;
+		}
+		m_GridPlayer[i] = player;
+	}
 
-		do
+	return ++m_GridSize[i] == TopologyOf(i)[TOPO_MAX];
+}
+
+// Play a move straight onto the board, only m_GridPlayer and m_GridSize are kept up to date.
+// The chain reaction goes off in a different order to AnimateScreen, but it's one player's atoms
+// going everywhere so what the board ends up as is nearly always the same.
+// Not quite always: if atoms reach a square while it's going off, AnimateScreen leaves that square
+// as player 0 with atoms on it, where this gives it to the mover. Replaying both on random positions
+// that's between 0.1% and 1.8% of them, and it only moves the score a little, so it's left as it is.
+void SimMove(uchar i, uchar player)
+{
+	uchar sp = 0;
+	uchar j;
+	uchar n;
+	uchar* topology;
+	uchar hadEnemies;
+	unsigned int explosions = 0;
+
+	m_SimEnemies = GRID_SQUARES - m_Owned[0] - m_Owned[player];
+	hadEnemies = m_SimEnemies != 0;
+	m_SimWon = 0;
+
+	if (SimAdd(i, player))
+	{
+		m_SimStack[sp++] = i;
+	}
+
+	while (sp)
+	{
+		i = m_SimStack[--sp];
+		topology = TopologyOf(i);
+
+		m_GridSize[i] -= topology[TOPO_MAX];
+		if (m_GridSize[i] >= topology[TOPO_MAX])
 		{
-			rndy = rand();
-			rndy = rndy & 0x7;
-		} while (rndy > 6);
+			m_SimStack[sp++] = i;
+		}
+		else if (!m_GridSize[i])
+		{
+			m_GridPlayer[i] = 0;
+		}
 
-		player = PlayerAtSquare(rndx, rndy);
+		for (j = topology[TOPO_COUNT]; j; j--)
+		{
+			n = topology[TOPO_LINKS + j - 1];
+			if (SimAdd(n, player))
+			{
+				m_SimStack[sp++] = n;
+			}
+		}
 
-		if (player == 0 || player == m_CurrentPlayer)
+		// Same as m_GameDecided, once the first round is over wiping everyone else out wins it.
+		if (hadEnemies && !m_SimEnemies && m_TurnCount)
 		{
-			IncrementSquare(rndx, rndy, m_CurrentPlayer);
-			done = 1;
+			m_SimWon = 1;
+			return;
 		}
 
-		attempt--;
+		if (++explosions >= AI_MAX_EXPLOSIONS)
+		{
+			return;
+		}
 	}
+}
+
+// How good the board looks for player after a SimMove. Atoms are worth one each (the other
+// players' count against), squares next to an enemy square that's about to go are likely lost,
+// and squares that are safe are worth more in the corners and on the edges (fewer ways to be taken)
+// and more again if they're critical, as that's a threat on everything around them.
+int AIScore(uchar player)
+{
+	int score = 0;
+	uchar i;
+	uchar j;
+	uchar n;
+	uchar max;
+	uchar safe;
+	uchar* topology;
 
-	while (!done)
+	if (m_SimWon)
 	{
-		rndx++;
+		return AI_WIN;
+	}
 
-		if (rndx > 9)
+	for (i = 0; i < GRID_SQUARES; i++)
+	{
+		if (!m_GridPlayer[i])
 		{
-			rndx = 0;
-			rndy++;
+			continue;
 		}
 
-		if (rndy > 6)
+		if (m_GridPlayer[i] != player)
 		{
-			rndy = 0;
-			rndx = 0;
+			score -= m_GridSize[i];
+			continue;
 		}
 
-		player = PlayerAtSquare(rndx, rndy);
+		topology = TopologyOf(i);
+		max = topology[TOPO_MAX];
+		score += m_GridSize[i];
+		safe = 1;
+
+		for (j = topology[TOPO_COUNT]; j; j--)
+		{
+			n = topology[TOPO_LINKS + j - 1];
+			if (m_GridPlayer[n] && m_GridPlayer[n] != player && m_GridSize[n] + 1 >= TopologyOf(n)[TOPO_MAX])
+			{
+				score -= 5 - max;
+				safe = 0;
+			}
+		}
 
-		if (player == 0 || player == m_CurrentPlayer)
+		if (safe)
 		{
-			IncrementSquare(rndx, rndy, m_CurrentPlayer);
-			done = 1;
+			if (max == 2)
+			{
+				score += 3;
+			}
+			else if (max == 3)
+			{
+				score += 2;
+			}
+
+			if (m_GridSize[i] + 1 == max)
+			{
+				score += 2;
+			}
 		}
 	}
 
-	CursorX = rndx;
-	CursorY = rndy;
+	return score;
+}
+
+// A frame of thinking, tries squares till the next frame comes round.
+// Returns 0 when everything has been tried, it's found a win, or it's out of time.
+uchar AIStep()
+{
+	unsigned int frame = m_FrameCount;
+	uchar i;
+	int score;
+
+	do
+	{
+		i = m_AINext;
+		if (++m_AINext >= GRID_SQUARES)
+		{
+			m_AINext = 0;
+		}
+		m_AILeft--;
+
+		if (!m_GridPlayer[i] || m_GridPlayer[i] == m_CurrentPlayer)
+		{
+			SimMove(i, m_CurrentPlayer);
+			score = AIScore(m_CurrentPlayer);
+			RestoreBoard(m_AIRoot);
+
+			if (m_AIBest == 255 || score > m_AIBestScore)
+			{
+				m_AIBest = i;
+				m_AIBestScore = score;
+			}
+
+			if (m_SimWon)
+			{
+				return 0;
+			}
+		}
+	} while (m_AILeft && frame == m_FrameCount);
+
+	return m_AILeft && (m_AIBest == 255 || m_FrameCount - m_AIStartFrame < AI_FRAME_BUDGET);
+}
+
+// Pick a square for the computer and go there.
+// Trying the squares from a random start means equal moves aren't always picked top left first.
+void AIInput()
+{
+	uchar* topology;
+
+	m_AINext = rand() % GRID_SQUARES;
+	m_AILeft = GRID_SQUARES;
+	m_AIBest = 255;
+	m_AIStartFrame = m_FrameCount;
+	SnapshotBoard(m_AIRoot);
+
+	RunPhase(AIStep, 1);
+
+	topology = TopologyOf(m_AIBest);
+	CursorX = topology[TOPO_X];
+	CursorY = topology[TOPO_Y];
+	IncrementSquare(CursorX, CursorY, m_CurrentPlayer);
 	DrawCursor(0);
+}
+
+// The turn counter and square counts along the bottom of the screen.
+// Numbers are kept as packed BCD and every character position remembers what it's showing,
+// so each turn only the digits that actually changed get drawn.
+#define HUD_Y 176
+#define HUD_CHARS 12
+
+// x of each character, 4 for the turn number (straight after "turn: ") then 2 for each player.
+uchar m_HudX[HUD_CHARS] = { 70, 78, 86, 94, 112, 120, 144, 152, 176, 184, 208, 216 };
+char m_HudShown[HUD_CHARS];
+
+uchar m_HudTurn[2];
+int m_HudTurnCount;
+uchar m_HudOwned[5];
+
+void HudPut(uchar pos, char c)
+{
+	char glyph[2];
+
+	if (m_HudShown[pos] != c)
+	{
+		glyph[0] = c;
+		glyph[1] = 0;
+		DrawString(m_HudX[pos], HUD_Y, glyph, Font2);
+		m_HudShown[pos] = c;
+	}
+}
+
+// Show a packed BCD number (low byte first) left aligned, blanking whatever is left over.
+void HudNumber(uchar pos, uchar* bcd, uchar digits)
+{
+	uchar i;
+	uchar digit;
+	uchar leading = 1;
+	uchar at = pos;
+
+	for(i = digits; i; i--)
+	{
+		digit = bcd[(i - 1) >> 1];
+		if (i & 1)
+		{
+			digit &= 15;
+		}
+		else
+		{
+			digit >>= 4;
+		}
+
+		if (digit || !leading || i == 1)
+		{
+			HudPut(at++, '0' + digit);
+			leading = 0;
+		}
+	}
+
+	while(at < pos + digits)
+	{
+		HudPut(at++, ' ');
+	}
+}
+
+void HudUpdate()
+{
+	uchar i;
+	uchar owned;
 
+	while(m_HudTurnCount != m_TurnCount)
+	{
+		BcdIncrement(m_HudTurn);
+		m_HudTurnCount++;
+	}
+	HudNumber(0, m_HudTurn, 4);
+
+	for(i = 1; i < 5; i++)
+	{
+		if (m_PlayerSetup[i] != 0)
+		{
+			owned = BcdFromByte(m_Owned[i]);
+			if (owned != m_HudOwned[i])
+			{
+				m_HudOwned[i] = owned;
+				HudNumber(2 + (i << 1), &m_HudOwned[i], 2);
+			}
+		}
+	}
+}
+
+// Call after the screen has been cleared and SetupGame.
+void HudReset()
+{
+	uchar i;
+	uchar col;
+
+	DrawString(22, HUD_Y, "turn: ", Font2);
+
+	for(i = 0; i < HUD_CHARS; i++)
+	{
+		m_HudShown[i] = ' ';
+	}
+
+	m_HudTurn[0] = 1;
+	m_HudTurn[1] = 0;
+	m_HudTurnCount = m_TurnCount;
+
+	for(i = 1; i < 5; i++)
+	{
+		m_HudOwned[i] = 255;
+		if (m_PlayerSetup[i] != 0)
+		{
+			col = m_HudX[2 + (i << 1)] >> 3;
+			SetAttribArea(col, col + 1, HUD_Y >> 3, HUD_Y >> 3, m_AttribPlayerMap[i]);
+		}
+	}
+
+	HudUpdate();
 }
 
 void GameplayLoop()
 {
 	uchar defaultAttrib = PAPER_BLUE | INK_WHITE | BRIGHT;
-	char a[16];
-	SetAttribArea(0,32,0,24, defaultAttrib);		
-	clg();
+	SyncFrame();
+	ClearScreen(defaultAttrib);
 	DrawGrid();	
 
-	DrawString(16,176,"turn: 1",Font2);
-
 	SetupGame();
-	getk(); // Clear the keyboard buffer
+	HudReset();
+	FlushKeys();
 
 	while(!m_GameFinished)
 	{
@@ -951,19 +1593,15 @@ void GameplayLoop()
 
 		AnimateScreen();
 		CheckForFinished();
-
-		clga(16, 176, 128, 8);
-
-		sprintf(a, "turn: %d", (m_TurnCount+1));
-		//DrawString(16, 176, "turn: ", Font2);
-		//a[0] = m_TurnCount + '0';
-		//a[1] = 0;
-		DrawString(22, 176, a, Font2);
+		HudUpdate();
 	}
 
 	Winner();
 }
 
+// Colours for the menu picture masks, the blue background and the white around the figure.
+uchar m_MenuPalette[] = { 0, INK_BLACK | PAPER_BLUE | BRIGHT, INK_BLACK | PAPER_WHITE | BRIGHT };
+
 uchar MenuX[] = {192, 16, 96, 192 };
 uchar MenuY[] = { 0, 96, 96, 96 };
 
@@ -980,37 +1618,32 @@ void DrawMenu(uchar* setup, char changed)
 			uchar x = (MenuX[i] >> 3);
 			uchar y = (MenuY[i] >> 3);
 
-			clga(MenuX[i], MenuY[i], 48, 48);
-			SetAttribArea(x, x + 5, y, y + 5, INK_BLACK | PAPER_BLUE | BRIGHT);
+			FillScreenArea(x, x + 5, MenuY[i], MenuY[i] + 47, 0);
 
 			switch (state)
 			{
 			case 0:
 			{
 				putsprite(SPR_OR, MenuX[i], MenuY[i], Empty);
-				SetAttribArea(x + 2, x + 4, y, y + 5, INK_BLACK | PAPER_WHITE | BRIGHT);
-				SetAttribArea(x + 1, x + 1, y + 4, y + 5, INK_BLACK | PAPER_WHITE | BRIGHT);
-				SetAttrib(y + 5, x + 5, INK_BLACK | PAPER_WHITE | BRIGHT);
+				ApplyAttribMask(MenuPersonAttribs, x, y, m_MenuPalette);
 				break;
 			}
 
 			case 1:
 			{
 				putsprite(SPR_OR, MenuX[i], MenuY[i], Prof);
-				SetAttribArea(x + 2, x + 4, y, y + 5, INK_BLACK | PAPER_WHITE | BRIGHT);
-				SetAttribArea(x + 1, x + 1, y + 4, y + 5, INK_BLACK | PAPER_WHITE | BRIGHT);
-				SetAttrib(y + 5, x + 5, INK_BLACK | PAPER_WHITE | BRIGHT);
+				ApplyAttribMask(MenuPersonAttribs, x, y, m_MenuPalette);
 				break;
 			}
 
 			case 2:
 			{
 				putsprite(SPR_OR, MenuX[i], MenuY[i], Robo);
-				SetAttribArea(x+2, x+4, y, y+3, INK_BLACK | PAPER_WHITE | BRIGHT);
-				SetAttribArea(x, x + 5, y + 4, y + 5, INK_BLACK | PAPER_WHITE | BRIGHT);
+				ApplyAttribMask(MenuRobotAttribs, x, y, m_MenuPalette);
 				break;
 			}
 			default:
+				SetAttribArea(x, x + 5, y, y + 5, INK_BLACK | PAPER_BLUE | BRIGHT);
 				break;
 			}
 		}
@@ -1020,28 +1653,161 @@ void DrawMenu(uchar* setup, char changed)
 
 void ColourStand(uchar i, uchar attrib)
 {
-	int x = (MenuX[i] >> 3);
-	int y = ((MenuY[i] + 48) >> 3);
-	SetAttribArea(x, x + 5, y, y + 3, attrib | INK_BLACK | BRIGHT);
-	SetAttribArea(x + 1, x + 4, y + 4, y + 5, attrib | INK_BLACK | BRIGHT);
+	uchar palette[2];
+	palette[1] = attrib | INK_BLACK | BRIGHT;
+	ApplyAttribMask(StandAttribs, MenuX[i] >> 3, (MenuY[i] + 48) >> 3, palette);
 }
 
 
 
 
+// The players picked on the menu, 0 = nobody, 1 = person, 2 = computer.
+uchar m_MenuSetup[4];
+
+// Show who's using what, a letter for each player from m_InputNames.
+void DrawInputs()
+{
+	char text[19];
+	uchar i;
+
+	strcpy(text, "qwer pads: k k k k");
+	for (i = 0; i < 4; i++)
+	{
+		text[11 + (i << 1)] = m_InputNames[m_PlayerInput[i + 1]];
+	}
+
+	DrawString(8, 88, text, Font2);
+}
+
+// A frame of the menu, returns 0 when the game is ready to start.
+uchar MenuStep()
+{
+	uchar k = 0;
+	char p= -1;
+	int i;
+
+	k = ReadKey();
+
+	switch (k)
+	{
+		case 49:
+		{
+			p = 0;
+			break;
+		}
+
+		case 50:
+		{
+			p = 1;
+			break;
+		}
+
+		case 51:
+		{
+			p = 2;
+			break;
+		}
+
+		case 52:
+		{
+			p = 3;
+			break;
+		}
+
+		// The settings are on letters, a Sinclair stick is the number keys and would change them.
+		case 's':
+		{
+			m_AnimSpeedSetting++;
+			if (m_AnimSpeedSetting >= ANIM_SPEEDS)
+			{
+				m_AnimSpeedSetting = 0;
+			}
+
+			PlaySound(m_SoundMove);
+			DrawString(16, 80, m_AnimSpeedNames[m_AnimSpeedSetting], Font2);
+			break;
+		}
+
+		case 'q':
+		case 'w':
+		case 'e':
+		case 'r':
+		{
+			i = strchr(m_InputKeys, k) - m_InputKeys + 1;
+			m_PlayerInput[i]++;
+			if (m_PlayerInput[i] >= INPUT_DEVICES)
+			{
+				m_PlayerInput[i] = INPUT_KEYS;
+			}
+
+			PlaySound(m_SoundMove);
+			DrawInputs();
+			break;
+		}
+
+		case 32:
+		{
+			uchar playerCount = 0;
+			uchar joyUsed = 0;
+
+			m_PlayerSetup[0] = 0;
+			for (i = 1; i < 5; i++)
+			{
+				m_PlayerSetup[i] = m_MenuSetup[i-1];
+
+				if (m_MenuSetup[i - 1] != 0)
+				{
+					playerCount++;
+				}
+
+				// Only read the sticks a person is actually playing with.
+				if (m_PlayerSetup[i] == 1)
+				{
+					joyUsed |= 1 << m_PlayerInput[i];
+				}
+			}
+
+			if (playerCount > 1)
+			{
+				UseJoysticks(joyUsed);
+				PlaySoundNow(m_SoundStart);
+				srand(clock());
+				return 0;
+			}
+			
+			break;
+		}
+	}
+
+	if (p != -1)
+	{
+		m_MenuSetup[p]++;
+
+		if (m_MenuSetup[p] > 2)
+		{
+			m_MenuSetup[p] = 0;
+		}
+
+		PlaySound(m_SoundMove);
+		DrawMenu(m_MenuSetup,p);
+	}
+
+	return 1;
+}
+
 void MainMenu()
 {
-	unsigned int counter = 0;
 	uchar defaultAttrib = PAPER_BLUE | INK_BLACK | BRIGHT;
-	int i = 0;
-	uchar setup[4];
 	//int size = 768;
 	//uchar attribs[768];
 
-	setup[0] = 1;
-	setup[1] = 2;
-	setup[2] = 0;
-	setup[3] = 0;
+	// Back to everything on the keyboard, the menu needs the number keys.
+	UseJoysticks(0);
+
+	m_MenuSetup[0] = 1;
+	m_MenuSetup[1] = 2;
+	m_MenuSetup[2] = 0;
+	m_MenuSetup[3] = 0;
 	
 
 	//for (i = 0; i < size; i++)
@@ -1049,9 +1815,8 @@ void MainMenu()
 		//attribs[i] = PAPER_BLUE | INK_BLACK | BRIGHT;
 	}
 
-	Halt();
-	clg();
-	SetAttribArea(0, 31, 0, 23, defaultAttrib);
+	SyncFrame();
+	ClearScreen(defaultAttrib);
 
 	putsprite(SPR_OR, 0, 0, Blackboard);
 	SetAttribArea(0, 19, 0, 9, PAPER_WHITE | INK_BLACK | BRIGHT);
@@ -1076,86 +1841,15 @@ void MainMenu()
 
 	DrawString(32, 40, "then press", Font2);
 	DrawString(24, 48, "space to play", Font2);
-	
-	DrawMenu(setup,-1);
-
-	getk();
-
-	while (1)
-	{
-		uchar k = 0;
-		char p= -1;
-		counter++;
-		Halt();
-		k = getk();
-
-		switch (k)
-		{
-			case 49:
-			{
-				p = 0;
-				break;
-			}
-
-			case 50:
-			{
-				p = 1;
-				break;
-			}
-
-			case 51:
-			{
-				p = 2;
-				break;
-			}
 
-			case 52:
-			{
-				p = 3;
-				break;
-			}
-
-			case 32:
-			{
-				uchar playerCount = 0;
-
-				m_PlayerSetup[0] = 0;
-				for (i = 1; i < 5; i++)
-				{
-					m_PlayerSetup[i] = setup[i-1];
-
-					if (setup[i - 1] != 0)
-					{
-						playerCount++;
-					}
-				}
-
-				if (playerCount > 1)
-				{
-					bit_fx4(7);
-					srand(clock());
-					return;
-				}
-				
-				break;
-			}
-		}
-
-		if (p != -1)
-		{
-			setup[p]++;
-
-			if (setup[p] > 2)
-			{
-				setup[p] = 0;
-			}
+	DrawString(16, 80, m_AnimSpeedNames[m_AnimSpeedSetting], Font2);
+	DrawInputs();
+	
+	DrawMenu(m_MenuSetup,-1);
 
+	FlushKeys();
 
-			Halt();
-			bit_fx(0);
-			DrawMenu(setup,p);
-		}
-	}
+	RunPhase(MenuStep, 1);
 }
 
 
@@ -1166,13 +1860,13 @@ void main ()
 	int y = 0;
 	int i =0;	
 
-	zx_border (BLUE);
+	SetBorder(BLUE);
 	SetupDefaults();
 
 	//TitleScreen();
 	//DrawAllSizes();
 
-	getk(); // Clear the keyboard buffer
+	FlushKeys();
 	while(1)
 	{
 		MainMenu();
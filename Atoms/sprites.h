@@ -30,6 +30,70 @@ char sprite14[] = { 16, 16, 0x02 , 0x06 , 0x03 , 0x0F , 0x07 , 0x9E , 0xC7 , 0xF
 	, 0x3F , 0xF1 , 0x7F , 0xE0 , 0xFF , 0xE0 , 0x00 , 0xE0 , 0x00 , 0xC0  };
 
 
+// The playing grid is made of just two different pixel lines, one with the vertical bars
+// and one where the horizontal bars cross them. DrawGrid copies these straight to the screen.
+// These are whole 32 byte screen lines, so there is no size at the start.
+uchar GridLineBars[] = {
+	0x18 , 0x00 , 0x00 , 0x18 , 0x00 , 0x00 , 0x18 , 0x00 , 0x00 , 0x18 , 0x00 , 0x00 , 0x18 , 0x00 , 0x00 , 0x18
+	, 0x00 , 0x00 , 0x18 , 0x00 , 0x00 , 0x18 , 0x00 , 0x00 , 0x18 , 0x00 , 0x00 , 0x18 , 0x00 , 0x00 , 0x18 , 0x00 };
+uchar GridLineCross[] = {
+	0xFF , 0xFF , 0xFF , 0xFF , 0xFF , 0xFF , 0xFF , 0xFF , 0xFF , 0xFF , 0xFF , 0xFF , 0xFF , 0xFF , 0xFF , 0xFF
+	, 0xFF , 0xFF , 0xFF , 0xFF , 0xFF , 0xFF , 0xFF , 0xFF , 0xFF , 0xFF , 0xFF , 0xFF , 0xFF , 0xFF , 0xFF , 0x00 };
+
+// The cursor, made from sprite4 - sprite11 laid out as the 8 characters around the edge of a square
+// (see CursorPartX / CursorPartY in main.c). Just the 8 bytes of each character, so it can be copied straight to the screen.
+uchar CursorImage[] = {
+	  0x00 , 0x00 , 0x18 , 0x18 , 0x1C , 0x1C , 0x1F , 0x1F	// left top
+	, 0x1F , 0x1F , 0x1C , 0x1C , 0x18 , 0x18 , 0x00 , 0x00	// left bottom
+	, 0x00 , 0x00 , 0x18 , 0x18 , 0x38 , 0x38 , 0xF8 , 0xF8	// right top
+	, 0xF8 , 0xF8 , 0x38 , 0x38 , 0x18 , 0x18 , 0x00 , 0x00	// right bottom
+	, 0x00 , 0x00 , 0x00 , 0x3F , 0x3F , 0x0F , 0x03 , 0x03	// top left
+	, 0x00 , 0x00 , 0x00 , 0xFC , 0xFC , 0xF0 , 0xC0 , 0xC0	// top right
+	, 0x03 , 0x03 , 0x0F , 0x3F , 0x3F , 0x00 , 0x00 , 0x00	// bottom left
+	, 0xC0 , 0xC0 , 0xF0 , 0xFC , 0xFC , 0x00 , 0x00 , 0x00	// bottom right
+	};
+
+// Attribute masks, applied with ApplyAttribMask.
+// Two bytes of width and height (in characters), then pairs of run length and colour going
+// along the attribute rows from the top left, ending with a 0 length.
+// Colour 0 leaves the attribute alone, anything else is looked up in the palette passed in.
+
+// The trophy on the winner screen. 1 is the winning player's colour, 2 the blue bits around the cup.
+uchar WinnerAttribs[] = {
+	27, 23,		// 27 x 23, at 2, 1
+	1, 0, 9, 1, 2, 2, 3, 1, 1, 2, 11, 1, 6, 0, 26, 1,
+	6, 0, 26, 1, 6, 0, 26, 1, 5, 0, 27, 1, 6, 0, 1, 1,
+	2, 2, 4, 1, 1, 2, 1, 1, 1, 2, 4, 1, 1, 2, 11, 1,
+	202, 0, 4, 1, 9, 0, 4, 1, 15, 0, 5, 1, 8, 0, 4, 1,
+	15, 0, 5, 1, 7, 0, 4, 1, 17, 0, 4, 1, 7, 0, 4, 1,
+	17, 0, 4, 1, 7, 0, 3, 1, 19, 0, 4, 1, 5, 0, 4, 1,
+	20, 0, 4, 1, 3, 0, 4, 1, 22, 0, 10, 1, 23, 0, 8, 1,
+	23, 0, 9, 1, 23, 0, 9, 1,
+	0 };
+
+// The menu picture for an empty slot or a human player, 1 is the background and 2 the white around the figure.
+uchar MenuPersonAttribs[] = {
+	6, 6,		// 6 x 6
+	2, 1, 3, 2, 1, 1, 26, 0, 2, 1, 3, 2, 1, 1, 26, 0,
+	2, 1, 3, 2, 1, 1, 26, 0, 2, 1, 3, 2, 1, 1, 26, 0,
+	1, 1, 4, 2, 1, 1, 26, 0, 1, 1, 5, 2,
+	0 };
+
+// Same again for the robot.
+uchar MenuRobotAttribs[] = {
+	6, 6,		// 6 x 6
+	2, 1, 3, 2, 1, 1, 26, 0, 2, 1, 3, 2, 1, 1, 26, 0,
+	2, 1, 3, 2, 1, 1, 26, 0, 2, 1, 3, 2, 1, 1, 26, 0,
+	6, 2, 26, 0, 6, 2,
+	0 };
+
+// The stand under each menu picture, filled with the player's colour.
+uchar StandAttribs[] = {
+	6, 6,		// 6 x 6
+	6, 1, 26, 0, 6, 1, 26, 0, 6, 1, 26, 0, 6, 1, 27, 0,
+	4, 1, 28, 0, 4, 1,
+	0 };
+
 
 // ASM art
 // with z88dk you can define something in ASM put access it from the C code
@@ -38,7 +102,8 @@ char sprite14[] = { 16, 16, 0x02 , 0x06 , 0x03 , 0x0F , 0x07 , 0x9E , 0xC7 , 0xF
 
 //extern uchar LoadingScreen[];
 extern uchar Font[];
-extern uchar WinnerScr[];
+extern uchar WinnerScrPixels[];
+extern uchar WinnerScrAttribs[];
 extern uchar Robo[];
 extern uchar Prof[];
 extern uchar Empty[];
@@ -56,8 +121,12 @@ extern uchar Font2[];
 //._LoadingScreen
 //	binary "screen.scr"
 
-._WinnerScr
-	binary "Winner.scr"
+// ZX7 packed by compiler.ps1, UnpackScr unpacks them.
+._WinnerScrPixels
+	binary "Winner.scr.pixels.zx7"
+
+._WinnerScrAttribs
+	binary "Winner.scr.attribs.zx7"
 
 
 ._Robo
@@ -273,8 +342,9 @@ extern uchar Font2[];
 	defb 255, 255
 
 
+// First character code then how many glyphs, 0 to z.
 ._Font2
-	DEFB	48
+	DEFB	48, 75
 	DEFB	8, 8, 127, 65, 65, 67, 67, 67, 127, 0
 	DEFB	8, 8, 8, 8, 8, 56, 56, 56, 56, 0
 	DEFB	8, 8, 127, 65, 1, 127, 112, 112, 127, 0
@@ -0,0 +1,119 @@
+#ifndef ATOMS_TOPOLOGY
+#define ATOMS_TOPOLOGY
+
+// The size of the playing board in squares.
+#define GRID_WIDTH 10
+#define GRID_HEIGHT 7
+#define GRID_SQUARES 70
+
+// Everything the game needs to know about the shape of the board, worked out ahead of time
+// so nothing has to test for edges and corners while it's running.
+// Each square gets 8 bytes so finding its entry is just "index << 3":
+//
+//	TOPO_MAX	how many atoms the square can hold before it goes critical
+//	TOPO_COUNT	how many neighbours the square has (the same as TOPO_MAX on this board)
+//	TOPO_LINKS	4 neighbour indices, unused ones are 255
+//	TOPO_X		the square's grid x
+//	TOPO_Y		the square's grid y
+//
+// If the board size changes this table needs remaking to match.
+#define TOPO_MAX 0
+#define TOPO_COUNT 1
+#define TOPO_LINKS 2
+#define TOPO_X 6
+#define TOPO_Y 7
+
+#define TopologyOf(i) (m_Topology + ((i) << 3))
+
+// The index of the first square on each row, so going from x, y to an index doesn't need a multiply.
+uchar m_GridRows[GRID_HEIGHT] = { 0, 10, 20, 30, 40, 50, 60 };
+
+#define GridIndex(x, y) (m_GridRows[y] + (x))
+
+uchar m_Topology[] = {
+	// Row 0
+	2, 2, 1, 10, 255, 255, 0, 0,
+	3, 3, 2, 11, 0, 255, 1, 0,
+	3, 3, 3, 12, 1, 255, 2, 0,
+	3, 3, 4, 13, 2, 255, 3, 0,
+	3, 3, 5, 14, 3, 255, 4, 0,
+	3, 3, 6, 15, 4, 255, 5, 0,
+	3, 3, 7, 16, 5, 255, 6, 0,
+	3, 3, 8, 17, 6, 255, 7, 0,
+	3, 3, 9, 18, 7, 255, 8, 0,
+	2, 2, 19, 8, 255, 255, 9, 0,
+
+	// Row 1
+	3, 3, 11, 0, 20, 255, 0, 1,
+	4, 4, 12, 1, 21, 10, 1, 1,
+	4, 4, 13, 2, 22, 11, 2, 1,
+	4, 4, 14, 3, 23, 12, 3, 1,
+	4, 4, 15, 4, 24, 13, 4, 1,
+	4, 4, 16, 5, 25, 14, 5, 1,
+	4, 4, 17, 6, 26, 15, 6, 1,
+	4, 4, 18, 7, 27, 16, 7, 1,
+	4, 4, 19, 8, 28, 17, 8, 1,
+	3, 3, 9, 29, 18, 255, 9, 1,
+
+	// Row 2
+	3, 3, 21, 10, 30, 255, 0, 2,
+	4, 4, 22, 11, 31, 20, 1, 2,
+	4, 4, 23, 12, 32, 21, 2, 2,
+	4, 4, 24, 13, 33, 22, 3, 2,
+	4, 4, 25, 14, 34, 23, 4, 2,
+	4, 4, 26, 15, 35, 24, 5, 2,
+	4, 4, 27, 16, 36, 25, 6, 2,
+	4, 4, 28, 17, 37, 26, 7, 2,
+	4, 4, 29, 18, 38, 27, 8, 2,
+	3, 3, 19, 39, 28, 255, 9, 2,
+
+	// Row 3
+	3, 3, 31, 20, 40, 255, 0, 3,
+	4, 4, 32, 21, 41, 30, 1, 3,
+	4, 4, 33, 22, 42, 31, 2, 3,
+	4, 4, 34, 23, 43, 32, 3, 3,
+	4, 4, 35, 24, 44, 33, 4, 3,
+	4, 4, 36, 25, 45, 34, 5, 3,
+	4, 4, 37, 26, 46, 35, 6, 3,
+	4, 4, 38, 27, 47, 36, 7, 3,
+	4, 4, 39, 28, 48, 37, 8, 3,
+	3, 3, 29, 49, 38, 255, 9, 3,
+
+	// Row 4
+	3, 3, 41, 30, 50, 255, 0, 4,
+	4, 4, 42, 31, 51, 40, 1, 4,
+	4, 4, 43, 32, 52, 41, 2, 4,
+	4, 4, 44, 33, 53, 42, 3, 4,
+	4, 4, 45, 34, 54, 43, 4, 4,
+	4, 4, 46, 35, 55, 44, 5, 4,
+	4, 4, 47, 36, 56, 45, 6, 4,
+	4, 4, 48, 37, 57, 46, 7, 4,
+	4, 4, 49, 38, 58, 47, 8, 4,
+	3, 3, 39, 59, 48, 255, 9, 4,
+
+	// Row 5
+	3, 3, 51, 40, 60, 255, 0, 5,
+	4, 4, 52, 41, 61, 50, 1, 5,
+	4, 4, 53, 42, 62, 51, 2, 5,
+	4, 4, 54, 43, 63, 52, 3, 5,
+	4, 4, 55, 44, 64, 53, 4, 5,
+	4, 4, 56, 45, 65, 54, 5, 5,
+	4, 4, 57, 46, 66, 55, 6, 5,
+	4, 4, 58, 47, 67, 56, 7, 5,
+	4, 4, 59, 48, 68, 57, 8, 5,
+	3, 3, 49, 69, 58, 255, 9, 5,
+
+	// Row 6
+	2, 2, 61, 50, 255, 255, 0, 6,
+	3, 3, 62, 51, 60, 255, 1, 6,
+	3, 3, 63, 52, 61, 255, 2, 6,
+	3, 3, 64, 53, 62, 255, 3, 6,
+	3, 3, 65, 54, 63, 255, 4, 6,
+	3, 3, 66, 55, 64, 255, 5, 6,
+	3, 3, 67, 56, 65, 255, 6, 6,
+	3, 3, 68, 57, 66, 255, 7, 6,
+	3, 3, 69, 58, 67, 255, 8, 6,
+	2, 2, 59, 68, 255, 255, 9, 6
+};
+
+#endif
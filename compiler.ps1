@@ -75,9 +75,54 @@ Write-Host "Z88dkPath: $Z88dkPath"
 
 
 
+# Packs the full screen .scr files with ZX7, UnpackScr unpacks them.
+# The pixels (first 6144 bytes) and attributes (last 768) are packed separately so they can be put on screen separately.
+# Only redone when the .scr is newer than what was packed from it.
+function CompressScreens()
+{
+    $packer = Get-Command "z88dk-zx7.exe" -ErrorAction SilentlyContinue
+    if(-not $packer)
+    {
+        $packer = Get-Command "zx7.exe" -ErrorAction SilentlyContinue
+    }
+
+    $screens = @("Winner.scr")
+
+    foreach($screen in $screens)
+    {
+        $source = "$SourceLocation\$screen"
+        $pixels = "$source.pixels"
+        $attribs = "$source.attribs"
+
+        if((Test-Path "$pixels.zx7") -and (Test-Path "$attribs.zx7") -and (Get-Item "$pixels.zx7").LastWriteTime -ge (Get-Item $source).LastWriteTime)
+        {
+            continue
+        }
+
+        if(-not $packer)
+        {
+            Write-Host "$screen is out of date, but no zx7 packer was found in $Z88dkBin"
+            continue
+        }
+
+        Write-Host "Packing $screen"
+        $bytes = [System.IO.File]::ReadAllBytes($source)
+        [System.IO.File]::WriteAllBytes($pixels, $bytes[0..6143])
+        [System.IO.File]::WriteAllBytes($attribs, $bytes[6144..6911])
+
+        & $packer.Source -f $pixels "$pixels.zx7" | Out-Null
+        & $packer.Source -f $attribs "$attribs.zx7" | Out-Null
+
+        Remove-Item $pixels
+        Remove-Item $attribs
+    }
+}
+
 function BuildCode()
 {
     Write-Host "Compiling Build"
+
+    CompressScreens
     $fileList = @("+zx", "-create-app")
 
     $list = Get-ChildItem -Path $SourceLocation -Filter "*.c" -Recurse
@@ -93,7 +138,7 @@ function BuildCode()
     }
 
 
-    if($Flavour -eq "Release")
+    if($Flavour -eq "Release" -or $Flavour -eq "Release128")
     {
         $fileList += "-O3"
         $fileList += "-Cz+zx"
@@ -105,6 +150,12 @@ function BuildCode()
         $fileList += "-DDEBUG"        
     }
 
+    # Release128 turns on the 128K shadow screen double buffering.
+    if($Flavour -eq "Release128")
+    {
+        $fileList += "-DDOUBLE_BUFFER"
+    }
+
     $fileList += "-lndos"
 
     $fileList += "-o"